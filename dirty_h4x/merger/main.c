@@ -126,19 +126,58 @@ static void unmapwrite(struct mappedpng png) {
 		fclose(png.f);
 }
 
-void blendRGBArow(png_bytep out, png_bytep up, png_bytep ovr, png_uint_32 x, png_uint_32 row, bool mask, float premult) {
+//Per-pixel issues are counted with bounded sample instead of printing each one
+#define DIAG_SAMPLES 8
+enum diagkind {
+	DIAG_ALPHA,
+	DIAG_CONFLICT,
+	DIAG_REDEFINE,
+	DIAG_KINDS
+};
+struct diagnostics {
+	size_t count[DIAG_KINDS];
+	png_uint_32 sample[DIAG_KINDS][DIAG_SAMPLES][2];
+};
+static const char *const diagnames[DIAG_KINDS] = {
+	"Warning: alpha is not 0 or 255",
+	"Warning: override conflicts with upstream template",
+	"Info: override redefines same value"
+};
+
+static void report(struct diagnostics *diag, enum diagkind kind, png_uint_32 x, png_uint_32 y) {
+	size_t n = diag->count[kind]++;
+	if(n < DIAG_SAMPLES) {
+		diag->sample[kind][n][0] = x;
+		diag->sample[kind][n][1] = y;
+	}
+}
+
+static void summary(struct diagnostics *diag, const char *subject) {
+	for(int k = 0; k < DIAG_KINDS; k++) {
+		size_t n = diag->count[k];
+		if(n == 0)
+			continue;
+		FILE *f = k == DIAG_REDEFINE ? stdout : stderr;
+		fprintf(f, "%s: %s at %zu pixels:", subject, diagnames[k], n);
+		for(size_t i = 0; i < n && i < DIAG_SAMPLES; i++)
+			fprintf(f, " (%"PRIu32" %"PRIu32")", diag->sample[k][i][0], diag->sample[k][i][1]);
+		fputs(n > DIAG_SAMPLES ? " ...\n" : "\n", f);
+	}
+}
+
+void blendRGBArow(struct diagnostics *diag, png_bytep out, png_bytep up, png_bytep ovr, png_uint_32 x, png_uint_32 row, bool mask, float premult) {
 	if(!mask)
 		premult = 1.f;
 	for(png_uint_32 i = 0; i < x; i++) {
 		png_byte a = ovr[i * 4 + 3];
 		if(a != 0) {
 			if(a != 255)
-				fprintf(stderr, "Warning: alpha at %"PRIu32" %"PRIu32" is not 0 or 255\n", i, row);
+				report(diag, DIAG_ALPHA, i, row);
 			if(!mask && up[i * 4 + 3] != 0)
 				if(((uint32_t*)up)[i] != ((uint32_t*)ovr)[i])
-					fprintf(stderr, "Warning: override conflicts with upstream template at %"PRIu32" %"PRIu32"\n", i, row);
+					report(diag, DIAG_CONFLICT, i, row);
 				else
-					printf("Info: override redefines same value at %"PRIu32" %"PRIu32"\n", i, row);
+					report(diag, DIAG_REDEFINE, i, row);
 			((uint32_t*)out)[i] = ((uint32_t*)ovr)[i];
 		} else {
 			if(premult != 1.f) {
@@ -189,6 +228,7 @@ void overlay(struct mappedpng up, struct mappedpng ovr, const char *outpath, boo
 			fprintf(stderr, "Failed to allocate memory!\n");
 			exit(-1);
 		}
+		struct diagnostics diag = {0};
 		void *outP, *upP, *ovrP;
 		outP = buf;
 		upP = buf + rb;
@@ -197,10 +237,11 @@ void overlay(struct mappedpng up, struct mappedpng ovr, const char *outpath, boo
 		for(png_uint_32 i = 0; i < up.y; i++) {
 			png_read_row(up.ptr, upP, NULL);
 			png_read_row(ovr.ptr, ovrP, NULL);
-			blendRGBArow(outP, upP, ovrP, up.x, i, mask, factor);
+			blendRGBArow(&diag, outP, upP, ovrP, up.x, i, mask, factor);
 			png_write_row(out.ptr, outP);
 		}
 		unmapwrite(out);
+		summary(&diag, outpath);
 	}
 	free(buf);
 }
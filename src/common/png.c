@@ -3,133 +3,284 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 #include <inttypes.h>
+#include <stdarg.h>
+#include <errno.h>
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
 
-struct mappedpng map(const char *path) {
-	struct mappedpng png = {0};
+#ifndef _MSC_VER
+__attribute__((format(printf, 3, 4)))
+#endif
+static void maplogf(const struct maplog *log, enum maploglevel level, const char *fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	if(log && log->fn) {
+		char msg[512];
+		vsnprintf(msg, sizeof(msg), fmt, args);
+		log->fn(log->user, level, msg);
+	} else {
+		vfprintf(level == MAPLOG_INFO ? stdout : stderr, fmt, args);
+		fputc('\n', level == MAPLOG_INFO ? stdout : stderr);
+	}
+	va_end(args);
+}
+
+static void pngerror(png_structp ptr, png_const_charp msg) {
+	maplogf(png_get_error_ptr(ptr), MAPLOG_ERROR, "libpng error: %s", msg);
+	png_longjmp(ptr, 1);
+}
+
+static void pngwarning(png_structp ptr, png_const_charp msg) {
+	maplogf(png_get_error_ptr(ptr), MAPLOG_WARN, "libpng warning: %s", msg);
+}
+
+static void memread(png_structp ptr, png_bytep data, size_t length) {
+	struct mapbuf *buf = png_get_io_ptr(ptr);
+	if(buf->size - buf->pos < length)
+		png_error(ptr, "unexpected end of data");
+	memcpy(data, buf->data + buf->pos, length);
+	buf->pos += length;
+}
+
+static void memwrite(png_structp ptr, png_bytep data, size_t length) {
+	struct mapbuf *buf = png_get_io_ptr(ptr);
+	if(buf->cap - buf->size < length) {
+		size_t cap = buf->cap ? buf->cap : 4096;
+		while(cap - buf->size < length)
+			cap *= 2;
+		png_bytep grown = realloc(buf->data, cap);
+		if(!grown)
+			png_error(ptr, "out of memory");
+		buf->data = grown;
+		buf->cap = cap;
+	}
+	memcpy(buf->data + buf->size, data, length);
+	buf->size += length;
+}
+
+static void memflush(png_structp ptr) {
+	(void)ptr;
+}
+
+//Path "-" is standard input or output
+static bool isstdio(const char *path) {
+	return path[0] == '-' && path[1] == '\0';
+}
+
+static FILE *openstd(FILE *f) {
+#ifdef _WIN32
+	_setmode(_fileno(f), _O_BINARY);
+#endif
+	return f;
+}
+
+//Standard streams are only flushed, they may be used after mapping
+static int closefile(FILE *f) {
+	if(f == stdin)
+		return 0;
+	if(f == stdout)
+		return fflush(f) != 0 ? -errno : 0;
+	return fclose(f) != 0 ? -errno : 0;
+}
+
+static int mapopen(const char *path, struct mapbuf *buf, struct mappedpng *png, const struct maplog *log) {
 	bool ok;
+	int err = -EIO;
 
-	printf("Info: opening %s\n", path);
-	png.f = fopen(path, "rb");
-	if(!png.f) {
-		fprintf(stderr, "Failed to open %s\n", path);
-		goto fail;
+	memset(png, 0, sizeof(*png));
+	png->log = log;
+	if(!buf && isstdio(path)) {
+		path = "standard input";
+		png->f = openstd(stdin);
+	} else if(!buf) {
+		maplogf(log, MAPLOG_INFO, "Info: opening %s", path);
+		png->f = fopen(path, "rb");
+		if(!png->f) {
+			maplogf(log, MAPLOG_ERROR, "Failed to open %s", path);
+			err = -errno;
+			goto fail;
+		}
 	}
 
-	png.ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-	if(!png.ptr) {
-		fprintf(stderr, "libpng error\n");
+	png->ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, (png_voidp)log, pngerror, pngwarning);
+	if(!png->ptr) {
+		maplogf(log, MAPLOG_ERROR, "libpng error");
+		err = -ENOMEM;
 		goto fail;
 	}
 
-	png.info = png_create_info_struct(png.ptr);
-	if(!png.info) {
-		fprintf(stderr, "libpng error\n");
+	png->info = png_create_info_struct(png->ptr);
+	if(!png->info) {
+		maplogf(log, MAPLOG_ERROR, "libpng error");
+		err = -ENOMEM;
 		goto fail;
 	}
 
-	if(setjmp(png_jmpbuf(png.ptr))) {
-		fprintf(stderr, "Failed to read %s\n", path);
+	if(setjmp(png_jmpbuf(png->ptr))) {
+		maplogf(log, MAPLOG_ERROR, "Failed to read %s", path);
+		err = -EIO;
 		goto fail;
 	}
 
-	png_init_io(png.ptr, png.f);
-	png_read_info(png.ptr, png.info);
+	if(buf)
+		png_set_read_fn(png->ptr, buf, memread);
+	else
+		png_init_io(png->ptr, png->f);
+	png_read_info(png->ptr, png->info);
 
-	png.colorType = png_get_color_type(png.ptr, png.info);
-	png.bitDepth = png_get_bit_depth(png.ptr, png.info);
-	ok = (png.colorType == PNG_COLOR_TYPE_RGBA || png.colorType == PNG_COLOR_TYPE_RGB) && png.bitDepth == 8;
-	ok |= png.colorType == PNG_COLOR_TYPE_PALETTE && png.bitDepth == 8;
+	png->colorType = png_get_color_type(png->ptr, png->info);
+	png->bitDepth = png_get_bit_depth(png->ptr, png->info);
+	ok = (png->colorType == PNG_COLOR_TYPE_RGBA || png->colorType == PNG_COLOR_TYPE_RGB) && png->bitDepth == 8;
+	ok |= png->colorType == PNG_COLOR_TYPE_PALETTE && png->bitDepth == 8;
 	if(!ok) {
-		fprintf(stderr, "This color type(%" PRIu8 ") or depth(%" PRIu8 ") is not supported, but used in %s\n", png.colorType, png.bitDepth, path);
+		maplogf(log, MAPLOG_ERROR, "This color type(%" PRIu8 ") or depth(%" PRIu8 ") is not supported, but used in %s", png->colorType, png->bitDepth, path);
+		err = -EINVAL;
+		goto fail;
+	}
+	if(png_get_interlace_type(png->ptr, png->info) != PNG_INTERLACE_NONE) {
+		maplogf(log, MAPLOG_ERROR, "Interlaced image %s is not supported", path);
+		err = -EINVAL;
 		goto fail;
 	}
 
-	if(png.colorType == PNG_COLOR_TYPE_PALETTE) {
-		png_uint_32 plt = png_get_PLTE(png.ptr, png.info, &png.paletted.plt, &png.paletted.numcolors);
-		plt = png_get_tRNS(png.ptr, png.info, &png.paletted.alpha, &png.paletted.numtransparent, NULL);
+	if(png->colorType == PNG_COLOR_TYPE_PALETTE) {
+		png_uint_32 plt = png_get_PLTE(png->ptr, png->info, &png->paletted.plt, &png->paletted.numcolors);
+		plt = png_get_tRNS(png->ptr, png->info, &png->paletted.alpha, &png->paletted.numtransparent, NULL);
 		if(plt == 0) {
-			fprintf(stderr, "Image %s has palette color type, but no transparency\n", path);
+			maplogf(log, MAPLOG_ERROR, "Image %s has palette color type, but no transparency", path);
+			err = -EINVAL;
 			goto fail;
 		}
 	}
 
-	png.x = png_get_image_width(png.ptr, png.info);
-	png.y = png_get_image_height(png.ptr, png.info);
+	png->x = png_get_image_width(png->ptr, png->info);
+	png->y = png_get_image_height(png->ptr, png->info);
 
-	if(png.x > INT32_MAX || png.y > INT32_MAX) {
-		fprintf(stderr, "Image %s is too big\n", path);
+	if(png->x > INT32_MAX || png->y > INT32_MAX) {
+		maplogf(log, MAPLOG_ERROR, "Image %s is too big", path);
+		err = -ERANGE;
 		goto fail;
 	}
 
 	int unit_type;
-	if(png_get_oFFs(png.ptr, png.info, &png.offset.x, &png.offset.y, &unit_type) == PNG_INFO_oFFs)
+	if(png_get_oFFs(png->ptr, png->info, &png->offset.x, &png->offset.y, &unit_type) == PNG_INFO_oFFs)
 		switch(unit_type) {
 			case PNG_OFFSET_PIXEL:
 				//Yay! Offset!
-				//png.offseted = true;
+				//png->offseted = true;
 				break;
 			case PNG_OFFSET_MICROMETER:
-				fprintf(stderr, "Image %s has set offset in micrometers instead of pixels\n", path);
+				maplogf(log, MAPLOG_ERROR, "Image %s has set offset in micrometers instead of pixels", path);
+				err = -EINVAL;
 				goto fail;
 			default:
-				fprintf(stderr, "Image %s has some bullshit offset type\n", path);
+				maplogf(log, MAPLOG_ERROR, "Image %s has some bullshit offset type", path);
+				err = -EINVAL;
 				goto fail;
 		}
 	else {
-		png.offset.x = 0;
-		png.offset.y = 0;
+		png->offset.x = 0;
+		png->offset.y = 0;
 	}
-	printf("Info: %s opened\n", path);
-	return png;
+	maplogf(log, MAPLOG_INFO, "Info: %s opened", path);
+	return 0;
 
 	fail:
-	png_destroy_read_struct(&png.ptr, &png.info, NULL);
-	if(png.f) {
-		fclose(png.f);
-		png.f = NULL;
+	png_destroy_read_struct(&png->ptr, &png->info, NULL);
+	if(png->f) {
+		closefile(png->f);
+		png->f = NULL;
 	}
-	png.ptr = NULL;
-	abort();
-	return png;
+	png->ptr = NULL;
+	return err;
+}
+
+int map(const char *path, struct mappedpng *png, const struct maplog *log) {
+	return mapopen(path, NULL, png, log);
+}
+
+int mapmem(struct mapbuf *buf, struct mappedpng *png, const struct maplog *log) {
+	return mapopen("memory buffer", buf, png, log);
 }
 
-void unmap(struct mappedpng *png) {
-	png_read_end(png->ptr, png->info);
+int unmap(struct mappedpng *png) {
+	int err = 0;
+	if(setjmp(png_jmpbuf(png->ptr)))
+		err = -EIO;
+	else if(png->row == png->y)
+		//Check trailing chunks only for fully read images
+		png_read_end(png->ptr, NULL);
 	png_destroy_read_struct(&png->ptr, &png->info, NULL);
 	if(png->f)
-		fclose(png->f);
+		closefile(png->f);
+	png->f = NULL;
+	return err;
 }
 
+int readrow(struct mappedpng *png, png_bytep row) {
+	if(setjmp(png_jmpbuf(png->ptr)))
+		return -EIO;
+	png_read_row(png->ptr, row, NULL);
+	png->row++;
+	return 0;
+}
 
-void mapwrite(const char *path, struct mappedpng *png) {
-	png->f = fopen(path, "wb");
-	if(!png->f) {
-		fprintf(stderr, "Failed to open for write \"%s\"", path);
-		goto fail;
+int readimage(struct mappedpng *png, png_bytepp rows) {
+	if(setjmp(png_jmpbuf(png->ptr)))
+		return -EIO;
+	png_read_image(png->ptr, rows);
+	png->row = png->y;
+	return 0;
+}
+
+
+int mapwrite(const char *path, struct mapbuf *buf, struct mappedpng *png, const struct maplog *log) {
+	int err = -EIO;
+	png->log = log;
+	png->f = NULL;
+	png->row = 0;
+	if(!buf && isstdio(path)) {
+		path = "standard output";
+		png->f = openstd(stdout);
+	} else if(!buf) {
+		png->f = fopen(path, "wb");
+		if(!png->f) {
+			maplogf(log, MAPLOG_ERROR, "Failed to open for write \"%s\"", path);
+			err = -errno;
+			goto fail;
+		}
 	}
 
 	png->write = true;
 
-	png->ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+	png->ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, (png_voidp)log, pngerror, pngwarning);
 	if(!png->ptr) {
-		fprintf(stderr, "Failed to create write context\n");
+		maplogf(log, MAPLOG_ERROR, "Failed to create write context");
+		err = -ENOMEM;
 		goto fail;
 	}
 
 	png->info = png_create_info_struct(png->ptr);
 	if(!png->info) {
-		fprintf(stderr, "Failed to create write context\n");
+		maplogf(log, MAPLOG_ERROR, "Failed to create write context");
+		err = -ENOMEM;
 		goto fail;
 	}
 
 	if(setjmp(png_jmpbuf(png->ptr))) {
-		fprintf(stderr, "Failed to write\n");
+		maplogf(log, MAPLOG_ERROR, "Failed to write");
 		goto fail;
 	}
 
-	png_init_io(png->ptr, png->f);
+	if(buf)
+		png_set_write_fn(png->ptr, buf, memwrite, memflush);
+	else
+		png_init_io(png->ptr, png->f);
 	png_set_sig_bytes(png->ptr, 0);
 
 	png_set_IHDR(png->ptr, png->info, png->x, png->y,
@@ -141,28 +292,71 @@ void mapwrite(const char *path, struct mappedpng *png) {
 		//Write palette
 		assert(png->paletted.plt);
 		png_set_PLTE(png->ptr, png->info, png->paletted.plt, png->paletted.numcolors);
-		assert(png->paletted.alpha);
-		png_set_tRNS(png->ptr, png->info, png->paletted.alpha, png->paletted.numtransparent, 0);
+		if(png->paletted.numtransparent > 0) {
+			assert(png->paletted.alpha);
+			png_set_tRNS(png->ptr, png->info, png->paletted.alpha, png->paletted.numtransparent, 0);
+		}
+	} else if((png->colorType == PNG_COLOR_TYPE_GRAY && png->paletted.numtransparent >= 2)
+			|| (png->colorType == PNG_COLOR_TYPE_RGB && png->paletted.numtransparent >= 6)) {
+		//Transparent color key, raw tRNS with 16 bit big endian samples
+		const png_byte *t = png->paletted.alpha;
+		png_color_16 key = {0};
+		if(png->colorType == PNG_COLOR_TYPE_GRAY)
+			key.gray = t[0] << 8 | t[1];
+		else {
+			key.red = t[0] << 8 | t[1];
+			key.green = t[2] << 8 | t[3];
+			key.blue = t[4] << 8 | t[5];
+		}
+		png_set_tRNS(png->ptr, png->info, NULL, 0, &key);
 	}
 
 	png_write_info(png->ptr, png->info);
-	printf("Info: %s opened\n", path);
-	return;
+	maplogf(log, MAPLOG_INFO, "Info: %s opened", buf ? "memory buffer" : path);
+	return 0;
 
 	fail:
 	png_destroy_write_struct(&png->ptr, &png->info);
 	if(png->f) {
-		fclose(png->f);
+		closefile(png->f);
 		png->f = NULL;
 	}
 	png->ptr = NULL;
-	abort();
-	return;
-}
-void unmapwrite(struct mappedpng png) {
-	printf("Written!\n");
-	png_write_end(png.ptr, png.info);
-	png_destroy_write_struct(&png.ptr, &png.info);
-	if(png.f)
-		fclose(png.f);
+	return err;
+}
+
+int unmapwrite(struct mappedpng *png) {
+	int err = 0;
+	if(setjmp(png_jmpbuf(png->ptr)))
+		err = -EIO;
+	else if(png->row == png->y) {
+		png_write_end(png->ptr, png->info);
+		maplogf(png->log, MAPLOG_INFO, "Written!");
+	} else
+		//Aborted write, leave truncated output
+		err = -EIO;
+	png_destroy_write_struct(&png->ptr, &png->info);
+	if(png->f) {
+		int ret = closefile(png->f);
+		if(err == 0)
+			err = ret;
+	}
+	png->f = NULL;
+	return err;
+}
+
+int writerow(struct mappedpng *png, png_const_bytep row) {
+	if(setjmp(png_jmpbuf(png->ptr)))
+		return -EIO;
+	png_write_row(png->ptr, row);
+	png->row++;
+	return 0;
+}
+
+int writeimage(struct mappedpng *png, png_bytepp rows) {
+	if(setjmp(png_jmpbuf(png->ptr)))
+		return -EIO;
+	png_write_image(png->ptr, rows);
+	png->row = png->y;
+	return 0;
 }
@@ -10,25 +10,57 @@ struct v2i32 {
 	png_int_32 x, y;
 };
 
+enum maploglevel {
+	MAPLOG_ERROR,
+	MAPLOG_WARN,
+	MAPLOG_INFO
+};
+
+//Message sink, NULL logger prints to stdout/stderr
+struct maplog {
+	void (*fn)(void *user, enum maploglevel level, const char *msg);
+	void *user;
+};
+
+//In-memory PNG stream, owned by caller and must outlive the mapping
+struct mapbuf {
+	png_bytep data;
+	size_t size;
+	size_t pos;//Read cursor
+	size_t cap;//Allocated for write, data is realloc'ed
+};
+
 struct mappedpng {
 	FILE *f;
 	png_structp ptr;
 	png_infop info;
 	png_uint_32 x, y;//size
+	png_uint_32 row;//Rows read or written so far
 	struct v2i32 offset;
 	struct {
 		png_colorp plt;
-		png_bytep alpha;
+		png_bytep alpha;//tRNS, written as color key for gray and RGB
 		int numcolors, numtransparent;
 	} paletted;
 	png_byte colorType, bitDepth;
 	bool write/*, offseted*/;
+	const struct maplog *log;
 };
 
-struct mappedpng map(const char *path);
-void unmap(struct mappedpng *png);
-void mapwrite(const char *path, struct mappedpng *png);
-void unmapwrite(struct mappedpng png);
+//All functions return 0 on success or negative errno value
+//Path "-" reads standard input or writes standard output
+
+int map(const char *path, struct mappedpng *png, const struct maplog *log);
+int mapmem(struct mapbuf *buf, struct mappedpng *png, const struct maplog *log);
+int unmap(struct mappedpng *png);
+int readrow(struct mappedpng *png, png_bytep row);
+int readimage(struct mappedpng *png, png_bytepp rows);
+
+//Writes to buf when it is not NULL, otherwise to path
+int mapwrite(const char *path, struct mapbuf *buf, struct mappedpng *png, const struct maplog *log);
+int unmapwrite(struct mappedpng *png);
+int writerow(struct mappedpng *png, png_const_bytep row);
+int writeimage(struct mappedpng *png, png_bytepp rows);
 #ifdef __cplusplus
 }
 #endif
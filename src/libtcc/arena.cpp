@@ -0,0 +1,77 @@
+#include "arena.hpp"
+
+#include <cerrno>
+#include <cstdlib>
+#ifndef NDEBUG
+#include <atomic>
+#include <new>
+#endif
+
+rowarena::~rowarena() {
+	free(base);
+}
+
+int rowarena::plan(std::span<const request> requests) {
+	struct slotstate {
+		size_t offset, capacity;
+		int64_t busy;//Until this row
+	};
+	std::vector<size_t> order(requests.size());
+	for(size_t i = 0; i < order.size(); i++)
+		order[i] = i;
+	std::stable_sort(order.begin(), order.end(), [&requests](size_t a, size_t b) {
+		return requests[a].from < requests[b].from;
+	});
+	//Best fit among slots free at start of live range
+	std::vector<slotstate> slots;
+	offsets.assign(requests.size(), 0);
+	total = 0;
+	for(size_t i : order) {
+		const request &r = requests[i];
+		slotstate *best = nullptr;
+		for(slotstate &s : slots)
+			if(s.busy <= r.from && s.capacity >= r.size && (!best || s.capacity < best->capacity))
+				best = &s;
+		if(!best) {
+			size_t capacity = (r.size + align - 1) / align * align;
+			slots.push_back({total, capacity ? capacity : align, INT64_MIN});
+			best = &slots.back();
+			total += best->capacity;
+		}
+		best->busy = r.to;
+		offsets[i] = best->offset;
+	}
+	free(base);
+	base = (png_bytep)aligned_alloc(align, total ? total : align);
+	return base ? 0 : -ENOMEM;
+}
+
+#ifndef NDEBUG
+//Counting replacement of global operator new, only in debug builds
+//Shared by all threads, so pipeline and writer threads are counted too
+static std::atomic<size_t> counter{0};
+
+size_t allocations() {
+	return counter.load(std::memory_order_relaxed);
+}
+
+void *operator new(size_t size) {
+	counter.fetch_add(1, std::memory_order_relaxed);
+	if(void *p = malloc(size ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+
+void *operator new(size_t size, const std::nothrow_t&) noexcept {
+	counter.fetch_add(1, std::memory_order_relaxed);
+	return malloc(size ? size : 1);
+}
+
+void operator delete(void *p) noexcept {
+	free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+	free(p);
+}
+#endif
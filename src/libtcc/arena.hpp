@@ -0,0 +1,38 @@
+#pragma once
+
+#include "internal.hpp"
+
+//Row buffers planned up front in one block of cache line aligned slots
+//Buffers whose live ranges do not intersect share slots
+class rowarena {
+public:
+	static constexpr size_t align = 64;
+
+	struct request {
+		size_t size;
+		int64_t from, to;//Live range in rows, to is exclusive
+	};
+
+	rowarena() = default;
+	~rowarena();
+	rowarena(const rowarena&) = delete;
+	rowarena &operator =(const rowarena&) = delete;
+
+	int plan(std::span<const request> requests);
+	png_bytep slot(size_t request) const {
+		return base + offsets[request];
+	}
+	size_t size() const {
+		return total;
+	}
+
+private:
+	png_bytep base = nullptr;
+	size_t total = 0;
+	std::vector<size_t> offsets;
+};
+
+#ifndef NDEBUG
+//Operator new calls made by any thread, proves that hot loops do not allocate
+size_t allocations();
+#endif
@@ -0,0 +1,302 @@
+#include "chunks.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <cinttypes>
+#include <new>
+#include <string>
+#include <thread>
+#include <zlib.h>
+
+//Catalog of template headers with uniform grid over their rectangles
+//Every entry is listed in every cell it touches, queries report it once
+//from the cell holding top-left corner of its intersection with query
+
+static const uint8_t catalogmagic[8] = {'T', 'C', 'C', 'C', 'A', 'T', '1', 0};
+
+struct catentry {
+	v2i32 offset;
+	png_uint_32 x, y;
+	uint32_t name;//Offset in names
+	uint32_t palette;
+	uint8_t colortype;
+	bool compiled;
+};
+
+struct tcc_catalog {
+	std::vector<catentry> entries;
+	std::string names;
+	v2i32 origin;
+	uint32_t cell, cols, rows;
+	//Entries of cell N are indices[cellstart[N]..cellstart[N + 1])
+	std::vector<uint32_t> cellstart, indices;
+};
+
+static int readentry(const tcc_source &src, catentry &e, diagnostics &diag) {
+	bytesource in;
+	pngheader hdr;
+	int err = in.open(src, diag);
+	if(err == 0)
+		err = readheader(in, hdr, false, diag);
+	if(err != 0)
+		return err;
+	e.offset = hdr.offset;
+	e.x = hdr.width;
+	e.y = hdr.height;
+	e.colortype = hdr.colortype;
+	e.palette = crc32(0, (const Bytef*)hdr.plt, hdr.numcolors * sizeof(color_t));
+	e.compiled = hdr.colortype == PNG_COLOR_TYPE_PALETTE && hdr.depth == 8 && hdr.numtrns == 1 && hdr.trns[0] == 0;
+	if(e.x == 0 || e.y == 0 || e.x > INT32_MAX || e.y > INT32_MAX
+			|| (int64_t)e.offset.x + e.x > INT32_MAX || (int64_t)e.offset.y + e.y > INT32_MAX) {
+		diag.error("File %s does not fit canvas coordinates", in.name());
+		return -ERANGE;
+	}
+	return 0;
+}
+
+//Cells are about the size of typical template, grid is kept proportional to entry count
+static void buildgrid(tcc_catalog &cat) {
+	std::vector<png_uint_32> sizes;
+	v2i32 min(INT32_MAX, INT32_MAX), max(INT32_MIN, INT32_MIN);
+	for(const catentry &e : cat.entries) {
+		sizes.push_back(std::max(e.x, e.y));
+		min = minel(min, e.offset);
+		max = maxel(max, e.offset + v2i32{(png_int_32)e.x, (png_int_32)e.y});
+	}
+	std::nth_element(sizes.begin(), sizes.begin() + sizes.size() / 2, sizes.end());
+	uint64_t cell = 16;
+	while(cell < sizes[sizes.size() / 2])
+		cell *= 2;
+	uint64_t w = (int64_t)max.x - min.x, h = (int64_t)max.y - min.y;
+	while(((w + cell - 1) / cell) * ((h + cell - 1) / cell) > 4 * cat.entries.size() + 1024)
+		cell *= 2;
+	cat.origin = min;
+	cat.cell = cell;
+	cat.cols = (w + cell - 1) / cell;
+	cat.rows = (h + cell - 1) / cell;
+
+	//Counting pass, then fill
+	cat.cellstart.assign((size_t)cat.cols * cat.rows + 1, 0);
+	auto cells = [&cat](const catentry &e, auto &&fn) {
+		uint32_t c0 = ((int64_t)e.offset.x - cat.origin.x) / cat.cell, c1 = ((int64_t)e.offset.x + e.x - 1 - cat.origin.x) / cat.cell;
+		uint32_t r0 = ((int64_t)e.offset.y - cat.origin.y) / cat.cell, r1 = ((int64_t)e.offset.y + e.y - 1 - cat.origin.y) / cat.cell;
+		for(uint32_t r = r0; r <= r1; r++)
+			for(uint32_t c = c0; c <= c1; c++)
+				fn((size_t)r * cat.cols + c);
+	};
+	for(const catentry &e : cat.entries)
+		cells(e, [&cat](size_t c) { cat.cellstart[c + 1]++; });
+	for(size_t c = 1; c < cat.cellstart.size(); c++)
+		cat.cellstart[c] += cat.cellstart[c - 1];
+	cat.indices.resize(cat.cellstart.back());
+	std::vector<uint32_t> fill(cat.cellstart.begin(), cat.cellstart.end() - 1);
+	for(size_t i = 0; i < cat.entries.size(); i++)
+		cells(cat.entries[i], [&](size_t c) { cat.indices[fill[c]++] = i; });
+}
+
+static int buildcatalog(const tcc_source *sources, size_t count, const tcc_catalog_options *opt, tcc_sink *sink, diagnostics &diag) {
+	if(count == 0 || count > UINT32_MAX) {
+		diag.error("Nothing to catalog");
+		return -EINVAL;
+	}
+
+	tcc_catalog cat;
+	cat.entries.resize(count);
+	std::vector<int> errs(count);
+	std::atomic<size_t> next{0};
+	auto work = [&]() {
+		for(size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < count;)
+			errs[i] = guarded(diag, [&]() {
+				return readentry(sources[i], cat.entries[i], diag);
+			});
+	};
+	unsigned threads = opt->threads ? opt->threads : std::max(1u, std::thread::hardware_concurrency());
+	threads = std::min<size_t>(threads, count);
+	std::vector<std::thread> workers;
+	try {
+		for(unsigned i = 1; i < threads; i++)
+			workers.emplace_back(work);
+	} catch(...) {
+		//Fewer workers are fine, calling thread works too
+	}
+	work();
+	for(std::thread &worker : workers)
+		worker.join();
+	for(int err : errs)
+		if(err != 0)
+			return err;
+
+	for(size_t i = 0; i < count; i++) {
+		cat.entries[i].name = cat.names.size();
+		cat.names += sources[i].path ? sources[i].path : "";
+		cat.names += '\0';
+	}
+	buildgrid(cat);
+
+	std::vector<uint8_t> out(catalogmagic, catalogmagic + sizeof(catalogmagic));
+	putle(out, count, 4);
+	putle(out, cat.cell, 4);
+	putle(out, (uint32_t)cat.origin.x, 4);
+	putle(out, (uint32_t)cat.origin.y, 4);
+	putle(out, cat.cols, 4);
+	putle(out, cat.rows, 4);
+	putle(out, cat.indices.size(), 4);
+	putle(out, cat.names.size(), 4);
+	for(const catentry &e : cat.entries) {
+		putle(out, (uint32_t)e.offset.x, 4);
+		putle(out, (uint32_t)e.offset.y, 4);
+		putle(out, e.x, 4);
+		putle(out, e.y, 4);
+		putle(out, e.name, 4);
+		putle(out, e.palette, 4);
+		putle(out, e.colortype, 1);
+		putle(out, e.compiled, 1);
+	}
+	for(uint32_t v : cat.cellstart)
+		putle(out, v, 4);
+	for(uint32_t v : cat.indices)
+		putle(out, v, 4);
+	out.insert(out.end(), cat.names.begin(), cat.names.end());
+	int err = writeblob(*sink, out.data(), out.size(), diag);
+	if(err == 0)
+		diag.info("Info: cataloged %zu files, %" PRIu32 "x%" PRIu32 " grid of %" PRIu32 " pixel cells, %zu bytes",
+			count, cat.cols, cat.rows, cat.cell, out.size());
+	return err;
+}
+
+int tcc_catalog_build(const tcc_source *sources, size_t count, const tcc_catalog_options *opt, tcc_sink *sink) {
+	const tcc_catalog_options defaults = {};
+	if(!opt)
+		opt = &defaults;
+	diagnostics diag(opt->log);
+	return guarded(diag, [&]() {
+		return buildcatalog(sources, count, opt, sink, diag);
+	});
+}
+
+static int parsecatalog(std::span<const uint8_t> data, tcc_catalog &cat) {
+	const uint8_t *p = data.data(), *end = p + data.size();
+	if(data.size() < 40 || memcmp(p, catalogmagic, sizeof(catalogmagic)) != 0)
+		return -EINVAL;
+	p += sizeof(catalogmagic);
+	uint64_t count = getle(p, 4);
+	cat.cell = getle(p, 4);
+	cat.origin.x = (int32_t)getle(p, 4);
+	cat.origin.y = (int32_t)getle(p, 4);
+	cat.cols = getle(p, 4);
+	cat.rows = getle(p, 4);
+	uint64_t nindices = getle(p, 4), namesize = getle(p, 4);
+	uint64_t ncells = (uint64_t)cat.cols * cat.rows;
+	if(cat.cell == 0 || (uint64_t)(end - p) != count * 26 + (ncells + 1) * 4 + nindices * 4 + namesize)
+		return -EINVAL;
+	cat.entries.resize(count);
+	for(catentry &e : cat.entries) {
+		e.offset.x = (int32_t)getle(p, 4);
+		e.offset.y = (int32_t)getle(p, 4);
+		e.x = getle(p, 4);
+		e.y = getle(p, 4);
+		e.name = getle(p, 4);
+		e.palette = getle(p, 4);
+		e.colortype = getle(p, 1);
+		e.compiled = getle(p, 1);
+		if(e.name >= namesize)
+			return -EINVAL;
+	}
+	cat.cellstart.resize(ncells + 1);
+	for(uint32_t &v : cat.cellstart)
+		v = getle(p, 4);
+	cat.indices.resize(nindices);
+	for(uint32_t &v : cat.indices)
+		if((v = getle(p, 4)) >= count)
+			return -EINVAL;
+	for(size_t c = 0; c < ncells; c++)
+		if(cat.cellstart[c] > cat.cellstart[c + 1])
+			return -EINVAL;
+	if(cat.cellstart.back() != nindices)
+		return -EINVAL;
+	cat.names.assign((const char*)p, namesize);
+	if(namesize == 0 || cat.names.back() != '\0')
+		return -EINVAL;
+	return 0;
+}
+
+static int loadcatalog(const tcc_source *src, tcc_catalog **cat, diagnostics &diag) {
+	bytesource in;
+	std::vector<uint8_t> data;
+	int err = in.open(*src, diag);
+	if(err == 0)
+		err = in.readall(data);
+	if(err != 0)
+		return err;
+	tcc_catalog *c = new(std::nothrow) tcc_catalog;
+	if(!c)
+		return -ENOMEM;
+	try {
+		err = parsecatalog(data, *c);
+	} catch(const std::bad_alloc&) {
+		err = -ENOMEM;
+	}
+	if(err != 0) {
+		if(err == -EINVAL)
+			diag.error("%s is not a valid catalog", in.name());
+		delete c;
+		return err;
+	}
+	*cat = c;
+	return 0;
+}
+
+int tcc_catalog_load(const tcc_source *src, const tcc_logger *log, tcc_catalog **cat) {
+	diagnostics diag(log);
+	return guarded(diag, [&]() {
+		return loadcatalog(src, cat, diag);
+	});
+}
+
+size_t tcc_catalog_size(const tcc_catalog *cat) {
+	return cat->entries.size();
+}
+
+void tcc_catalog_get(const tcc_catalog *cat, size_t index, tcc_catalog_entry *entry) {
+	const catentry &e = cat->entries[index];
+	entry->name = cat->names.c_str() + e.name;
+	entry->x = e.offset.x;
+	entry->y = e.offset.y;
+	entry->width = e.x;
+	entry->height = e.y;
+	entry->palette = e.palette;
+	entry->colortype = e.colortype;
+	entry->compiled = e.compiled;
+}
+
+size_t tcc_catalog_query(const tcc_catalog *cat, int32_t x, int32_t y, uint32_t width, uint32_t height, size_t *indices, size_t cap) {
+	//Query clipped to grid, in grid coordinates
+	int64_t left = std::max<int64_t>((int64_t)x - cat->origin.x, 0);
+	int64_t top = std::max<int64_t>((int64_t)y - cat->origin.y, 0);
+	int64_t right = std::min<int64_t>((int64_t)x - cat->origin.x + width, (int64_t)cat->cols * cat->cell);
+	int64_t bottom = std::min<int64_t>((int64_t)y - cat->origin.y + height, (int64_t)cat->rows * cat->cell);
+	if(left >= right || top >= bottom)
+		return 0;
+	size_t found = 0;
+	for(int64_t r = top / cat->cell; r <= (bottom - 1) / cat->cell; r++)
+		for(int64_t c = left / cat->cell; c <= (right - 1) / cat->cell; c++) {
+			size_t cell = r * cat->cols + c;
+			for(uint32_t k = cat->cellstart[cell]; k < cat->cellstart[cell + 1]; k++) {
+				const catentry &e = cat->entries[cat->indices[k]];
+				int64_t el = (int64_t)e.offset.x - cat->origin.x, et = (int64_t)e.offset.y - cat->origin.y;
+				if(el >= right || el + e.x <= left || et >= bottom || et + e.y <= top)
+					continue;
+				//Report once, from cell of intersection corner
+				if(std::max(el, left) / cat->cell != c || std::max(et, top) / cat->cell != r)
+					continue;
+				if(found < cap)
+					indices[found] = cat->indices[k];
+				found++;
+			}
+		}
+	return found;
+}
+
+void tcc_catalog_free(tcc_catalog *cat) {
+	delete cat;
+}
@@ -0,0 +1,209 @@
+#include "internal.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdlib>
+#include <thread>
+
+enum checkfail {
+	CHECK_OPEN = 1,
+	CHECK_COLORTYPE = 2,
+	CHECK_TRNS = 4,
+	CHECK_PALETTE = 8,
+	CHECK_BOUNDS = 16,
+	CHECK_INDEX = 32,
+	CHECK_DECODE = 64
+};
+
+struct checkresult {
+	unsigned fails = 0;
+	const char *name;
+	v2i32 offset;
+	png_uint_32 x = 0, y = 0;
+	//First index past palette
+	png_uint_32 badx, bady;
+	uint8_t badindex;
+	std::vector<color_t> palette;
+};
+
+//Check one input, decode stops at first bad index
+static void checkone(const tcc_source &src, bool decode, checkresult &res, diagnostics &diag) {
+	mappedio io;
+	if(opensource(src, io, diag) != 0) {
+		res.name = src.path ? src.path : "memory buffer";
+		res.fails = CHECK_OPEN;
+		return;
+	}
+	mappedpng &png = io.png;
+	res.name = io.name;
+	res.offset = png.offset;
+	res.x = png.x;
+	res.y = png.y;
+	if(png.colorType != PNG_COLOR_TYPE_PALETTE) {
+		res.fails |= CHECK_COLORTYPE;
+		unmap(&png);
+		return;
+	}
+	if(png.paletted.numtransparent != 1 || png.paletted.alpha[0] != 0)
+		res.fails |= CHECK_TRNS;
+	res.palette.assign(png.paletted.plt, png.paletted.plt + png.paletted.numcolors);
+	if((int64_t)png.offset.x + png.x > INT32_MAX || (int64_t)png.offset.y + png.y > INT32_MAX)
+		res.fails |= CHECK_BOUNDS;
+	if(decode) {
+		std::vector<uint8_t> row(png.x);
+		const uint8_t limit = png.paletted.numcolors - 1;
+		for(png_uint_32 y = 0; y < png.y; y++) {
+			if(readrow(&png, row.data()) != 0) {
+				res.fails |= CHECK_DECODE;
+				break;
+			}
+			uint8_t m = 0;
+			for(uint8_t v : row)
+				m = std::max(m, v);
+			if(m > limit) {
+				res.fails |= CHECK_INDEX;
+				size_t x = std::find_if(row.begin(), row.end(), [limit](uint8_t v) { return v > limit; }) - row.begin();
+				res.badx = x;
+				res.bady = y;
+				res.badindex = row[x];
+				break;
+			}
+		}
+	}
+	if(unmap(&png) != 0)
+		res.fails |= CHECK_DECODE;
+}
+
+//Count pairs of inputs with intersecting rectangles, print first of them
+static size_t overlaps(std::span<const checkresult> results, diagnostics &diag) {
+	struct edge {
+		png_int_32 left, right, top, bottom;
+		size_t index;
+	};
+	std::vector<edge> rects;
+	for(size_t i = 0; i < results.size(); i++) {
+		const checkresult &r = results[i];
+		if(r.fails & (CHECK_OPEN | CHECK_BOUNDS))
+			continue;
+		rects.push_back({r.offset.x, r.offset.x + (png_int_32)r.x, r.offset.y, r.offset.y + (png_int_32)r.y, i});
+	}
+	//Sweep along x keeping rectangles that still span current left edge
+	std::sort(rects.begin(), rects.end(), [](const edge &a, const edge &b) {
+		return a.left < b.left;
+	});
+	std::vector<const edge*> active;
+	size_t pairs = 0;
+	for(const edge &e : rects) {
+		std::erase_if(active, [&e](const edge *a) {
+			return a->right <= e.left;
+		});
+		for(const edge *a : active)
+			if(a->top < e.bottom && e.top < a->bottom) {
+				if(pairs++ < diagnostics::samplecap) {
+					size_t first = std::min(a->index, e.index), second = std::max(a->index, e.index);
+					diag.info("Info: %s overlaps %s", results[first].name, results[second].name);
+				}
+			}
+		active.push_back(&e);
+	}
+	return pairs;
+}
+
+static int checkinputs(const tcc_source *sources, size_t count, const tcc_check_options *opt, diagnostics &diag) {
+	if(count == 0) {
+		diag.error("Nothing to check");
+		return -EINVAL;
+	}
+
+	std::vector<checkresult> results(count);
+	std::atomic<size_t> next{0};
+	auto work = [&]() {
+		for(size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < count;) {
+			int err = guarded(diag, [&]() {
+				checkone(sources[i], !opt->headersonly, results[i], diag);
+				return 0;
+			});
+			//Input that could not be examined counts as unopened
+			if(err != 0) {
+				results[i].name = sources[i].path ? sources[i].path : "memory buffer";
+				results[i].fails = CHECK_OPEN;
+			}
+		}
+	};
+	unsigned threads = opt->threads ? opt->threads : std::max(1u, std::thread::hardware_concurrency());
+	threads = std::min<size_t>(threads, count);
+	std::vector<std::thread> workers;
+	try {
+		for(unsigned i = 1; i < threads; i++)
+			workers.emplace_back(work);
+	} catch(...) {
+		//Fewer workers are fine, calling thread works too
+	}
+	work();
+	for(std::thread &worker : workers)
+		worker.join();
+	//Reference palette is one of the first input that has it, every input is opened once
+	const checkresult *reference = nullptr;
+	for(checkresult &r : results) {
+		if(r.palette.empty())
+			continue;
+		if(!reference)
+			reference = &r;
+		else if(r.palette != reference->palette)
+			r.fails |= CHECK_PALETTE;
+	}
+
+	//Report in command line order
+	size_t failed = 0;
+	v2i32 min(INT32_MAX, INT32_MAX);
+	int64_t maxx = INT64_MIN, maxy = INT64_MIN;
+	for(const checkresult &r : results) {
+		if(r.fails & CHECK_COLORTYPE)
+			diag.error("File %s is not a compiled template", r.name);
+		if(r.fails & CHECK_TRNS)
+			diag.warn("File %s does not seems to be compiled template", r.name);
+		if(r.fails & CHECK_PALETTE)
+			diag.error("Palette of %s differs from %s, recompile all images", r.name, reference->name);
+		if(r.fails & CHECK_BOUNDS)
+			diag.error("File %s at %+" PRIi32 "%+" PRIi32 " does not fit canvas coordinates", r.name, r.offset.x, r.offset.y);
+		if(r.fails & CHECK_INDEX)
+			diag.error("File %s has index %u past palette at (%" PRIu32 ",%" PRIu32 ")", r.name, r.badindex, r.badx, r.bady);
+		if(r.fails & CHECK_DECODE)
+			diag.error("File %s is corrupt", r.name);
+		if(r.fails & ~CHECK_TRNS)
+			failed++;
+		if(!(r.fails & (CHECK_OPEN | CHECK_BOUNDS))) {
+			min = minel(min, r.offset);
+			maxx = std::max(maxx, (int64_t)r.offset.x + r.x);
+			maxy = std::max(maxy, (int64_t)r.offset.y + r.y);
+		}
+	}
+	int err = 0;
+	if(maxx != INT64_MIN && (maxx - min.x > INT32_MAX || maxy - min.y > INT32_MAX)) {
+		diag.error("Linked canvas would be too big, %" PRIi64 "x%" PRIi64, maxx - min.x, maxy - min.y);
+		err = -ERANGE;
+	}
+	size_t pairs = overlaps(results, diag);
+	if(pairs)
+		diag.info("Info: %zu pairs of inputs overlap, use link -conflicts to see where they disagree", pairs);
+	if(failed) {
+		diag.error("%zu of %zu inputs would fail link", failed, count);
+		err = -EINVAL;
+	}
+	if(err != 0)
+		return err;
+	diag.info("Info: %zu inputs are fine, canvas %" PRIi64 "x%" PRIi64 " at %+" PRIi32 "%+" PRIi32,
+		count, maxx - min.x, maxy - min.y, min.x, min.y);
+	return 0;
+}
+
+int tcc_check(const tcc_source *sources, size_t count, const tcc_check_options *opt) {
+	const tcc_check_options defaults = {};
+	if(!opt)
+		opt = &defaults;
+	diagnostics diag(opt->log);
+	return guarded(diag, [&]() {
+		return checkinputs(sources, count, opt, diag);
+	});
+}
@@ -0,0 +1,241 @@
+#include "chunks.hpp"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+static inline uint32_t be32(const uint8_t *p) {
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+bytesource::~bytesource() {
+	if(f)
+		fclose(f);
+}
+
+int bytesource::open(const tcc_source &src, diagnostics &diag) {
+	if(src.path && src.path[0] == '-' && src.path[1] == '\0') {
+		//Pipes can not seek, so whole stream is kept in memory
+		path = "standard input";
+#ifdef _WIN32
+		_setmode(_fileno(stdin), _O_BINARY);
+#endif
+		uint8_t buf[65536];
+		size_t n;
+		try {
+			while((n = fread(buf, 1, sizeof(buf), stdin)) != 0)
+				owned.insert(owned.end(), buf, buf + n);
+		} catch(const std::bad_alloc&) {
+			diag.error("Out of memory");
+			return -ENOMEM;
+		}
+		if(ferror(stdin)) {
+			diag.error("Failed to read %s", path);
+			return -EIO;
+		}
+		data = owned.data();
+		size = owned.size();
+		return 0;
+	}
+	if(src.path) {
+		path = src.path;
+		f = fopen(src.path, "rb");
+		if(!f) {
+			int err = -errno;
+			diag.error("Failed to open %s", src.path);
+			return err;
+		}
+		return 0;
+	}
+	if(!src.data) {
+		diag.error("Source has neither path nor data");
+		return -EINVAL;
+	}
+	data = (const uint8_t*)src.data;
+	size = src.size;
+	return 0;
+}
+
+size_t bytesource::read(void *buf, size_t n) {
+	if(f)
+		return fread(buf, 1, n, f);
+	if(n > size - pos)
+		n = size - pos;
+	memcpy(buf, data + pos, n);
+	pos += n;
+	return n;
+}
+
+int bytesource::seek(uint64_t offset) {
+	if(f)
+		return fseeko(f, offset, SEEK_SET) == 0 ? 0 : -errno;
+	if(offset > size)
+		return -EINVAL;
+	pos = offset;
+	return 0;
+}
+
+int bytesource::readall(std::vector<uint8_t> &out) {
+	uint8_t buf[65536];
+	size_t n;
+	while((n = read(buf, sizeof(buf))) != 0)
+		out.insert(out.end(), buf, buf + n);
+	return f && ferror(f) ? -EIO : 0;
+}
+
+unsigned pngheader::bpp() const {
+	switch(colortype) {
+		case PNG_COLOR_TYPE_GRAY:
+		case PNG_COLOR_TYPE_PALETTE:
+			return 1;
+		case PNG_COLOR_TYPE_GRAY_ALPHA:
+			return 2;
+		case PNG_COLOR_TYPE_RGB:
+			return 3;
+		default:
+			return 4;
+	}
+}
+
+int readheader(bytesource &src, pngheader &hdr, bool collectidat, diagnostics &diag) {
+	static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+	uint8_t buf[8];
+	if(src.read(buf, 8) != 8 || memcmp(buf, signature, 8) != 0) {
+		diag.error("%s is not a PNG", src.name());
+		return -EINVAL;
+	}
+	hdr.numcolors = hdr.numtrns = 0;
+	hdr.offset = {0, 0};
+	hdr.idat.clear();
+	hdr.datasize = 0;
+	hdr.idatcrc = 0;
+	bool ihdr = false;
+	uint64_t pos = 8;
+	for(;;) {
+		if(src.read(buf, 8) != 8)
+			break;
+		uint32_t length = be32(buf);
+		const uint8_t *type = buf + 4;
+		pos += 8;
+		if(length > 0x7FFFFFFF)
+			break;
+		if(memcmp(type, "IDAT", 4) == 0) {
+			if(!ihdr)
+				break;
+			if(!collectidat)
+				return 0;
+			hdr.idat.push_back({pos, length});
+			hdr.datasize += length;
+			uint8_t crc[4];
+			if(src.seek(pos + length) != 0 || src.read(crc, 4) != 4)
+				break;
+			hdr.idatcrc = hdr.idatcrc * 31 + be32(crc);
+		} else if(memcmp(type, "IEND", 4) == 0) {
+			if(!ihdr || hdr.idat.empty())
+				break;
+			return 0;
+		} else if(memcmp(type, "IHDR", 4) == 0 || memcmp(type, "PLTE", 4) == 0
+				|| memcmp(type, "tRNS", 4) == 0 || memcmp(type, "oFFs", 4) == 0) {
+			uint8_t data[768];
+			if(length > sizeof(data) || src.read(data, length) != length)
+				break;
+			if(memcmp(type, "IHDR", 4) == 0) {
+				if(length != 13)
+					break;
+				hdr.width = be32(data);
+				hdr.height = be32(data + 4);
+				hdr.depth = data[8];
+				hdr.colortype = data[9];
+				hdr.interlace = data[12];
+				ihdr = true;
+			} else if(memcmp(type, "PLTE", 4) == 0) {
+				hdr.numcolors = length / 3;
+				for(int i = 0; i < hdr.numcolors; i++)
+					hdr.plt[i] = {data[i * 3], data[i * 3 + 1], data[i * 3 + 2]};
+			} else if(memcmp(type, "tRNS", 4) == 0) {
+				hdr.numtrns = length < 256 ? length : 256;
+				memcpy(hdr.trns, data, hdr.numtrns);
+			} else if(length == 9) {
+				if(data[8] != PNG_OFFSET_PIXEL) {
+					diag.error("Image %s has set offset in micrometers instead of pixels", src.name());
+					return -EINVAL;
+				}
+				hdr.offset = {(png_int_32)be32(data), (png_int_32)be32(data + 4)};
+			}
+			if(src.seek(pos + length + 4) != 0)
+				break;
+		} else if(src.seek(pos + length + 4) != 0)
+			break;
+		pos += length + 4;
+	}
+	diag.error("Failed to parse %s", src.name());
+	return -EIO;
+}
+
+int idatstream::seek(uint64_t offset) {
+	for(chunk = 0; chunk < hdr.idat.size() && offset >= hdr.idat[chunk].length; chunk++)
+		offset -= hdr.idat[chunk].length;
+	if(chunk == hdr.idat.size())
+		return -EINVAL;
+	left = hdr.idat[chunk].length - offset;
+	return src.seek(hdr.idat[chunk].offset + offset);
+}
+
+size_t idatstream::read(uint8_t *buf, size_t n) {
+	size_t done = 0;
+	while(done < n) {
+		if(left == 0) {
+			if(++chunk >= hdr.idat.size() || src.seek(hdr.idat[chunk].offset) != 0)
+				break;
+			left = hdr.idat[chunk].length;
+			continue;
+		}
+		size_t want = n - done < left ? n - done : left;
+		size_t got = src.read(buf + done, want);
+		done += got;
+		left -= got;
+		if(got != want)
+			break;
+	}
+	return done;
+}
+
+static inline uint8_t paeth(uint8_t a, uint8_t b, uint8_t c) {
+	int p = a + b - c, pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+	return pa <= pb && pa <= pc ? a : (pb <= pc ? b : c);
+}
+
+bool unfilter(uint8_t type, uint8_t *row, const uint8_t *prev, size_t n, unsigned bpp) {
+	switch(type) {
+		case PNG_FILTER_VALUE_NONE:
+			break;
+		case PNG_FILTER_VALUE_SUB:
+			for(size_t i = bpp; i < n; i++)
+				row[i] += row[i - bpp];
+			break;
+		case PNG_FILTER_VALUE_UP:
+			for(size_t i = 0; i < n; i++)
+				row[i] += prev[i];
+			break;
+		case PNG_FILTER_VALUE_AVG:
+			for(size_t i = 0; i < bpp; i++)
+				row[i] += prev[i] / 2;
+			for(size_t i = bpp; i < n; i++)
+				row[i] += (row[i - bpp] + prev[i]) / 2;
+			break;
+		case PNG_FILTER_VALUE_PAETH:
+			for(size_t i = 0; i < bpp; i++)
+				row[i] += prev[i];
+			for(size_t i = bpp; i < n; i++)
+				row[i] += paeth(row[i - bpp], prev[i], prev[i - bpp]);
+			break;
+		default:
+			return false;
+	}
+	return true;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+//Minimal PNG chunk reader for tools that do not need libpng decode
+
+#include "internal.hpp"
+
+#include <cstdio>
+
+//File or memory backed tcc_source with random access
+class bytesource {
+public:
+	bytesource() = default;
+	~bytesource();
+	bytesource(const bytesource&) = delete;
+	bytesource &operator =(const bytesource&) = delete;
+
+	int open(const tcc_source &src, diagnostics &diag);
+	//Returns bytes read, less than n only at end of data
+	size_t read(void *buf, size_t n);
+	int seek(uint64_t offset);
+	//Read everything from current position
+	int readall(std::vector<uint8_t> &data);
+	const char *name() const {
+		return path;
+	}
+
+private:
+	FILE *f = nullptr;
+	const uint8_t *data = nullptr;
+	size_t size = 0, pos = 0;
+	std::vector<uint8_t> owned;//Of standard input
+	const char *path = "memory buffer";
+};
+
+struct idatchunk {
+	uint64_t offset;//Of chunk data in file
+	uint32_t length;
+};
+
+struct pngheader {
+	uint32_t width, height;
+	uint8_t depth, colortype, interlace;
+	color_t plt[256];
+	int numcolors;
+	uint8_t trns[256];
+	int numtrns;
+	v2i32 offset;
+	//Filled when IDAT chunks are collected
+	std::vector<idatchunk> idat;
+	uint64_t datasize;
+	uint32_t idatcrc;//Combined CRC of all IDAT chunks, identifies image data
+
+	unsigned bpp() const;
+};
+
+//Parse chunks up to first IDAT, or up to IEND collecting IDAT positions
+int readheader(bytesource &src, pngheader &hdr, bool collectidat, diagnostics &diag);
+
+//Sequential reader of concatenated IDAT payloads with seeking by payload offset
+class idatstream {
+public:
+	idatstream(bytesource &src, const pngheader &hdr) : src(src), hdr(hdr) {}
+	int seek(uint64_t offset);
+	size_t read(uint8_t *buf, size_t n);
+
+private:
+	bytesource &src;
+	const pngheader &hdr;
+	size_t chunk = 0;
+	uint32_t left = 0;//Left in current chunk
+};
+
+//Little endian fields of tcc's own sidecar files
+inline void putle(std::vector<uint8_t> &out, uint64_t v, unsigned bytes) {
+	for(unsigned i = 0; i < bytes; i++)
+		out.push_back(v >> (i * 8));
+}
+
+inline uint64_t getle(const uint8_t *&p, unsigned bytes) {
+	uint64_t v = 0;
+	for(unsigned i = 0; i < bytes; i++)
+		v |= (uint64_t)*p++ << (i * 8);
+	return v;
+}
+
+//Undo PNG row filter in place, prev is previous unfiltered row
+bool unfilter(uint8_t type, uint8_t *row, const uint8_t *prev, size_t n, unsigned bpp);
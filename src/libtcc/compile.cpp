@@ -0,0 +1,188 @@
+#include "dither.hpp"
+#include "histogram.hpp"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cinttypes>
+#include <memory>
+
+static void palettizerow(diagnostics &diag, const tcc_palette &plt, const uint8_t *in, uint8_t *out, png_uint_32 width, png_uint_32 y) {
+	for(png_uint_32 x = 0; x < width; x++, in += 4) {
+		const uint8_t alpha = in[3];
+		if(alpha != 255) {
+			if(alpha)
+				diag.report(DIAG_SEMITRANSPARENT, x, y);
+			out[x] = 0;
+			continue;
+		}
+		//Find color
+		uint8_t index = plt.find((uint32_t)in[0] << 16 | (uint32_t)in[1] << 8 | in[2]);
+		if(index == 0)
+			//Color not found in palette
+			//NOTE: how compiler should behave?
+			diag.report(DIAG_OUTOFPALETTE, x, y);
+		out[x] = index;
+	}
+}
+
+int tcc_compile_pixels(const tcc_palette *plt, const uint8_t *rgba, uint32_t width, uint32_t height, size_t stride,
+		uint8_t *out, size_t outstride, const tcc_logger *log) {
+	diagnostics diag(log);
+	for(uint32_t y = 0; y < height; y++)
+		palettizerow(diag, *plt, rgba + stride * y, out + outstride * y, width, y);
+	diag.summary("pixels");
+	return 0;
+}
+
+//Converts input rows to output indices one at a time
+struct rowcompiler {
+	mappedpng &input;
+	const tcc_palette &plt;
+	std::vector<uint8_t> pltpair, rgba;
+	std::unique_ptr<ditherer> dt;
+	png_uint_32 y = 0;
+
+	rowcompiler(mappedpng &input, const tcc_palette &plt): input(input), plt(plt) {}
+	int init(diagnostics &diag, enum tcc_dither dither) {
+		if(input.colorType == PNG_COLOR_TYPE_PALETTE) {
+			std::vector<color_t> palette(plt.colors);
+			return plt2pltTable(diag, std::span<color_t>(input.paletted.plt, input.paletted.numcolors), std::span<const uint8_t>(input.paletted.alpha, input.paletted.numtransparent), palette, false, pltpair);
+		}
+		if(input.colorType != PNG_COLOR_TYPE_RGBA) {
+			diag.error("Tried to compile pure RGB image. Is it a template?");
+			return -EINVAL;
+		}
+		try {
+			rgba.resize((size_t)input.x * 4);
+			if(dither != TCC_DITHER_NONE)
+				dt = std::make_unique<ditherer>(plt, dither, input.x);
+		} catch(const std::bad_alloc&) {
+			diag.error("Out of memory");
+			return -ENOMEM;
+		}
+		return 0;
+	}
+	int row(diagnostics &diag, uint8_t *out) {
+		if(input.colorType == PNG_COLOR_TYPE_PALETTE) {
+			int err = readrow(&input, out);
+			if(err != 0)
+				return err;
+			for(png_uint_32 x = 0; x < input.x; x++)
+				out[x] = pltpair[out[x]];
+		} else {
+			int err = readrow(&input, rgba.data());
+			if(err != 0)
+				return err;
+			if(dt)
+				dt->row(diag, rgba.data(), out, y);
+			else
+				palettizerow(diag, plt, rgba.data(), out, input.x, y);
+		}
+		y++;
+		return 0;
+	}
+};
+
+static int compileimage(const tcc_palette *plt, const tcc_source *input, const tcc_compile_options *opt, tcc_sink *sink, diagnostics &diag) {
+	mappedio in;
+	int err = opensource(*input, in, diag);
+	if(err != 0)
+		return err;
+	rowcompiler rc(in.png, *plt);
+	err = rc.init(diag, opt->dither);
+	//Trim needs opaque bounding box before output, so compiled rows are kept,
+	//otherwise rows stream from input to output
+	std::vector<uint8_t> data;
+	if(err == 0)
+		try {
+			data.resize((size_t)in.png.x * (opt->trim ? in.png.y : 1));
+		} catch(const std::bad_alloc&) {
+			diag.error("Out of memory");
+			err = -ENOMEM;
+		}
+	v2i32 origin{0, 0}, size{(png_int_32)in.png.x, (png_int_32)in.png.y};
+	if(err == 0 && opt->trim) {
+		bbox box;
+		size_t first, last;
+		for(png_uint_32 y = 0; y < in.png.y && err == 0; y++) {
+			err = rc.row(diag, data.data() + (size_t)in.png.x * y);
+			if(err == 0 && rowbounds(data.data() + (size_t)in.png.x * y, in.png.x, first, last))
+				box.addrow(y, first, last);
+		}
+		if(err == 0 && box.empty()) {
+			//PNG can not be empty, keep single transparent pixel
+			diag.warn("%s is fully transparent", in.name);
+			size = {1, 1};
+		} else if(err == 0) {
+			origin = {box.left, box.top};
+			size = {box.right - box.left + 1, box.bottom - box.top + 1};
+		}
+		if(err == 0 && (size.x != (png_int_32)in.png.x || size.y != (png_int_32)in.png.y))
+			diag.info("Info: trimmed %s from %" PRIu32 "x%" PRIu32 " to %" PRIi32 "x%" PRIi32 " at %+" PRIi32 "%+" PRIi32,
+				in.name, in.png.x, in.png.y, size.x, size.y, origin.x, origin.y);
+	}
+	if(err != 0) {
+		unmap(&in.png);
+		return err;
+	}
+
+	//Prepare output
+	std::vector<color_t> palette(plt->colors);
+	palette.insert(palette.begin(), {0, 0, 0});
+	uint8_t zero = 0;
+	mappedio out;
+	mappedpng &output = out.png;
+	output.x = size.x;
+	output.y = size.y;
+	output.colorType = PNG_COLOR_TYPE_PALETTE;
+	output.bitDepth = 8;
+	output.offset.x = opt->offsetx + origin.x;
+	output.offset.y = opt->offsety + origin.y;
+	output.write = true;
+	output.paletted.alpha = &zero;
+	output.paletted.numtransparent = 1;
+	output.paletted.plt = palette.data();
+	output.paletted.numcolors = palette.size();
+	err = opensink(*sink, out, diag);
+	if(err != 0) {
+		unmap(&in.png);
+		return err;
+	}
+	histogram hist;
+	if(opt->histogram)
+		err = hist.init(output, opt->histogramtile, 0, diag);
+
+	//Write
+	for(png_uint_32 i = 0; i < output.y && err == 0; i++) {
+		png_bytep row;
+		if(opt->trim)
+			row = data.data() + (size_t)in.png.x * (origin.y + i) + origin.x;
+		else {
+			row = data.data();
+			err = rc.row(diag, row);
+			if(err != 0)
+				break;
+		}
+		err = writerow(&output, row);
+		if(opt->histogram)
+			hist.row(row);
+	}
+	err = closesink(*sink, out, err);
+	int ret = unmap(&in.png);
+	if(err == 0)
+		err = ret;
+	if(err == 0 && opt->histogram)
+		err = hist.write(*opt->histogram, {}, diag);
+	diag.summary(in.name);
+	return err;
+}
+
+int tcc_compile(const tcc_palette *plt, const tcc_source *input, const tcc_compile_options *opt, tcc_sink *sink) {
+	const tcc_compile_options defaults = {};
+	if(!opt)
+		opt = &defaults;
+	diagnostics diag(opt->log);
+	return guarded(diag, [&]() {
+		return compileimage(plt, input, opt, sink, diag);
+	});
+}
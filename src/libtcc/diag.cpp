@@ -0,0 +1,108 @@
+#include "diag.hpp"
+
+#include <cstdarg>
+#include <cstdio>
+#include <cinttypes>
+
+static const char *const kindnames[DIAG_KINDS] = {
+	"semi-transparent pixels (marked transparent)",
+	"out-of-palette pixels (marked transparent)",
+	"conflicting pixels of overlapping inputs",
+};
+
+static void maplogger(void *user, enum maploglevel level, const char *msg) {
+	diagnostics &diag = *static_cast<diagnostics*>(user);
+	switch(level) {
+		case MAPLOG_ERROR:
+			diag.error("%s", msg);
+			break;
+		case MAPLOG_WARN:
+			diag.warn("%s", msg);
+			break;
+		case MAPLOG_INFO:
+			diag.info("%s", msg);
+			break;
+	}
+}
+
+diagnostics::diagnostics(const tcc_logger *logger) :
+	sink(logger ? *logger : tcc_logger{nullptr, nullptr, TCC_NORMAL}), lvl(sink.verbosity), maplogger{::maplogger, this} {}
+
+void diagnostics::emit(tcc_loglevel level, const char *msg) {
+	if(sink.fn) {
+		sink.fn(sink.user, level, msg);
+		return;
+	}
+	//Single write per message, no per-line flushing
+	switch(level) {
+		case TCC_LOG_ERROR:
+			fprintf(stderr, "Error: %s\n", msg);
+			break;
+		case TCC_LOG_WARN:
+			fprintf(stderr, "Warning: %s\n", msg);
+			break;
+		case TCC_LOG_INFO:
+			fprintf(stdout, "%s\n", msg);
+			break;
+	}
+}
+
+void diagnostics::report(diagkind kind, png_uint_32 x, png_uint_32 y, size_t n) {
+	kindstate &state = kinds[kind];
+	state.count.fetch_add(n, std::memory_order_relaxed);
+	if(state.sampled.load(std::memory_order_relaxed) >= samplecap)
+		return;
+	size_t slot = state.sampled.fetch_add(1, std::memory_order_relaxed);
+	if(slot < samplecap)
+		state.samples[slot] = {(png_int_32)x, (png_int_32)y};
+}
+
+void diagnostics::vemit(tcc_loglevel level, const char *fmt, va_list args) {
+	char msg[512];
+	vsnprintf(msg, sizeof(msg), fmt, args);
+	emit(level, msg);
+}
+
+void diagnostics::error(const char *fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	vemit(TCC_LOG_ERROR, fmt, args);
+	va_end(args);
+}
+
+void diagnostics::warn(const char *fmt, ...) {
+	if(lvl < TCC_NORMAL)
+		return;
+	va_list args;
+	va_start(args, fmt);
+	vemit(TCC_LOG_WARN, fmt, args);
+	va_end(args);
+}
+
+void diagnostics::info(const char *fmt, ...) {
+	if(lvl < TCC_VERBOSE)
+		return;
+	va_list args;
+	va_start(args, fmt);
+	vemit(TCC_LOG_INFO, fmt, args);
+	va_end(args);
+}
+
+void diagnostics::summary(const char *subject) {
+	for(size_t k = 0; k < DIAG_KINDS; k++) {
+		kindstate &state = kinds[k];
+		size_t n = state.count.exchange(0, std::memory_order_relaxed);
+		size_t shown = state.sampled.exchange(0, std::memory_order_relaxed);
+		if(n == 0 || lvl < TCC_NORMAL)
+			continue;
+		//Build sample list in one go
+		char samples[samplecap * 28 + 8], *p = samples;
+		if(shown > samplecap)
+			shown = samplecap;
+		for(size_t i = 0; i < shown; i++)
+			p += sprintf(p, " (%" PRIi32 ",%" PRIi32 ")", state.samples[i].x, state.samples[i].y);
+		if(shown < n)
+			sprintf(p, " ...");
+		warn("%s: %zu %s, at%s", subject, n, kindnames[k], samples);
+	}
+}
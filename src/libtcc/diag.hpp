@@ -0,0 +1,71 @@
+#pragma once
+
+#include "common/png.h"
+#include "tcc.h"
+
+#include <atomic>
+#include <array>
+#include <cstddef>
+#include <cstdarg>
+
+#ifdef _MSC_VER
+#define DIAG_PRINTF(fmt, args)
+#else
+#define DIAG_PRINTF(fmt, args) __attribute__((format(printf, fmt, args)))
+#endif
+
+//Per-pixel issue kinds, counted instead of printed
+enum diagkind {
+	DIAG_SEMITRANSPARENT,
+	DIAG_OUTOFPALETTE,
+	DIAG_CONFLICT,
+	DIAG_KINDS
+};
+
+//Collects diagnostics of a single run
+//Per-pixel issues are only counted with bounded sample of coordinates
+//and printed once by summary()
+class diagnostics {
+public:
+	static constexpr size_t samplecap = 8;
+
+	//NULL logger prints to stdout/stderr with normal verbosity
+	explicit diagnostics(const tcc_logger *logger);
+	diagnostics(const diagnostics&) = delete;
+	diagnostics &operator =(const diagnostics&) = delete;
+
+	//Safe to call from hot loops and from multiple threads
+	void report(diagkind kind, png_uint_32 x, png_uint_32 y, size_t n = 1);
+
+	void error(const char *fmt, ...) DIAG_PRINTF(2, 3);
+	void warn(const char *fmt, ...) DIAG_PRINTF(2, 3);
+	void info(const char *fmt, ...) DIAG_PRINTF(2, 3);
+
+	//Print counters and samples of reported issues and reset them
+	void summary(const char *subject);
+
+	size_t count(diagkind kind) const {
+		return kinds[kind].count.load(std::memory_order_relaxed);
+	}
+	//Logger for png.c
+	const struct maplog *log() const {
+		return &maplogger;
+	}
+	tcc_verbosity level() const {
+		return lvl;
+	}
+
+private:
+	struct kindstate {
+		std::atomic<size_t> count{0}, sampled{0};
+		std::array<v2i32, samplecap> samples;
+	};
+
+	void emit(tcc_loglevel level, const char *msg);
+	void vemit(tcc_loglevel level, const char *fmt, va_list args);
+
+	tcc_logger sink;
+	tcc_verbosity lvl;
+	struct maplog maplogger;
+	std::array<kindstate, DIAG_KINDS> kinds;
+};
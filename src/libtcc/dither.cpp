@@ -0,0 +1,174 @@
+#include "dither.hpp"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static const uint8_t bayer[8][8] = {
+	{0, 32, 8, 40, 2, 34, 10, 42},
+	{48, 16, 56, 24, 50, 18, 58, 26},
+	{12, 44, 4, 36, 14, 46, 6, 38},
+	{60, 28, 52, 20, 62, 30, 54, 22},
+	{3, 35, 11, 43, 1, 33, 9, 41},
+	{51, 19, 59, 27, 49, 17, 57, 25},
+	{15, 47, 7, 39, 13, 45, 5, 37},
+	{63, 31, 55, 23, 61, 29, 53, 21}
+};
+//Range of ordered offsets, about distance between neighbour colors of typical palette
+static constexpr int ORDEREDSPREAD = 32;
+
+ditherer::ditherer(const tcc_palette &plt, int mode, png_uint_32 width): plt(plt), mode(mode), width(width), cube(32 * 32 * 32, 0), exact(32 * 32 * 32, 0) {
+	for(const color_t &c : plt.colors)
+		exact[cell(c.red, c.green, c.blue)] = 1;
+	if(!plt.colors.empty())
+		for(int r = 0; r < 32; r++)
+			for(int g = 0; g < 32; g++)
+				for(int b = 0; b < 32; b++) {
+					int cr = r * 8 + 4, cg = g * 8 + 4, cb = b * 8 + 4;
+					int best = INT32_MAX;
+					uint8_t &cell = cube[r << 10 | g << 5 | b];
+					for(size_t i = 0; i < plt.colors.size(); i++) {
+						const color_t &c = plt.colors[i];
+						int d = (c.red - cr) * (c.red - cr) + (c.green - cg) * (c.green - cg) + (c.blue - cb) * (c.blue - cb);
+						if(d < best) {
+							best = d;
+							cell = i + 1;
+						}
+					}
+				}
+	if(mode != TCC_DITHER_ORDERED)
+		for(std::vector<int16_t> &e : errors)
+			e.assign(((size_t)width + 4) * 3, 0);
+}
+
+//Transparent and exact pixels, false when pixel has to be dithered
+bool ditherer::fixed(diagnostics &diag, const uint8_t *px, uint8_t &out, png_uint_32 x, png_uint_32 y) const {
+	if(px[3] != 255) {
+		if(px[3])
+			diag.report(DIAG_SEMITRANSPARENT, x, y);
+		out = 0;
+		return true;
+	}
+	if(!exact[cell(px[0], px[1], px[2])])
+		return false;
+	out = plt.find((uint32_t)px[0] << 16 | (uint32_t)px[1] << 8 | px[2]);
+	return out != 0;
+}
+
+void ditherer::ordered(diagnostics &diag, const uint8_t *in, uint8_t *out, png_uint_32 y) {
+	const uint8_t *m = bayer[y & 7];
+	png_uint_32 x = 0;
+#ifdef __SSE2__
+	//Offsets of 8 pixels of this matrix row split by sign for saturating add and subtract
+	alignas(16) uint8_t pos[32] = {}, neg[32] = {};
+	for(int i = 0; i < 8; i++) {
+		int bias = (m[i] - 32) * ORDEREDSPREAD / 64;
+		for(int c = 0; c < 3; c++) {
+			pos[i * 4 + c] = std::max(bias, 0);
+			neg[i * 4 + c] = std::max(-bias, 0);
+		}
+	}
+	const __m128i mask = _mm_set1_epi32(0x1F), alpha = _mm_set1_epi32((int)0xFF000000);
+	//Cube cell from top 5 bits of R, G and B
+	auto cells = [&mask](__m128i v) {
+		__m128i r = _mm_slli_epi32(_mm_and_si128(_mm_srli_epi32(v, 3), mask), 10);
+		__m128i g = _mm_slli_epi32(_mm_and_si128(_mm_srli_epi32(v, 11), mask), 5);
+		__m128i b = _mm_and_si128(_mm_srli_epi32(v, 19), mask);
+		return _mm_or_si128(_mm_or_si128(r, g), b);
+	};
+	alignas(16) uint32_t biased[4], own[4];
+	for(; x + 4 <= width; x += 4) {
+		const int p = (x & 7) * 4;
+		__m128i v = _mm_loadu_si128((const __m128i*)(in + x * 4));
+		const bool opaque = _mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(v, alpha), alpha)) == 0xFFFF;
+		_mm_store_si128((__m128i*)own, cells(v));
+		v = _mm_subs_epu8(_mm_adds_epu8(v, _mm_load_si128((const __m128i*)(pos + p))), _mm_load_si128((const __m128i*)(neg + p)));
+		_mm_store_si128((__m128i*)biased, cells(v));
+		//Opaque pixels outside of palette cells can not be exact, skip palette lookups
+		if(opaque && !(exact[own[0]] | exact[own[1]] | exact[own[2]] | exact[own[3]])) {
+			for(int k = 0; k < 4; k++)
+				out[x + k] = cube[biased[k]];
+			continue;
+		}
+		for(int k = 0; k < 4; k++)
+			if(!fixed(diag, in + (x + k) * 4, out[x + k], x + k, y))
+				out[x + k] = cube[biased[k]];
+	}
+#endif
+	for(; x < width; x++) {
+		const uint8_t *px = in + x * 4;
+		if(fixed(diag, px, out[x], x, y))
+			continue;
+		int bias = (m[x & 7] - 32) * ORDEREDSPREAD / 64;
+		out[x] = nearest(std::clamp(px[0] + bias, 0, 255), std::clamp(px[1] + bias, 0, 255), std::clamp(px[2] + bias, 0, 255));
+	}
+}
+
+//Errors are scaled by 16, serpentine order
+void ditherer::floyd(diagnostics &diag, const uint8_t *in, uint8_t *out, png_uint_32 y) {
+	int16_t *cur = errors[0].data() + 6, *next = errors[1].data() + 6;
+	const int dir = (y & 1) ? -1 : 1;
+	for(png_uint_32 i = 0; i < width; i++) {
+		const png_uint_32 x = dir > 0 ? i : width - 1 - i;
+		const uint8_t *px = in + x * 4;
+		if(fixed(diag, px, out[x], x, y))
+			continue;
+		int16_t *ce = cur + x * 3, *ne = next + x * 3;
+		int c[3];
+		for(int k = 0; k < 3; k++)
+			c[k] = std::clamp(px[k] + ((ce[k] + 8) >> 4), 0, 255);
+		const uint8_t index = nearest(c[0], c[1], c[2]);
+		out[x] = index;
+		if(index == 0)
+			continue;
+		const color_t &p = plt.colors[index - 1];
+		const int e[3] = {c[0] - p.red, c[1] - p.green, c[2] - p.blue};
+		for(int k = 0; k < 3; k++) {
+			ce[dir * 3 + k] += e[k] * 7;
+			ne[-dir * 3 + k] += e[k] * 3;
+			ne[k] += e[k] * 5;
+			ne[dir * 3 + k] += e[k];
+		}
+	}
+	std::fill(errors[0].begin(), errors[0].end(), 0);
+	std::swap(errors[0], errors[1]);
+}
+
+//Errors are scaled by 8, only 6/8 of error is spread
+void ditherer::atkinson(diagnostics &diag, const uint8_t *in, uint8_t *out, png_uint_32 y) {
+	int16_t *cur = errors[0].data() + 6, *next = errors[1].data() + 6, *after = errors[2].data() + 6;
+	for(png_uint_32 x = 0; x < width; x++) {
+		const uint8_t *px = in + x * 4;
+		if(fixed(diag, px, out[x], x, y))
+			continue;
+		int16_t *ce = cur + x * 3, *ne = next + x * 3, *ae = after + x * 3;
+		int c[3];
+		for(int k = 0; k < 3; k++)
+			c[k] = std::clamp(px[k] + ((ce[k] + 4) >> 3), 0, 255);
+		const uint8_t index = nearest(c[0], c[1], c[2]);
+		out[x] = index;
+		if(index == 0)
+			continue;
+		const color_t &p = plt.colors[index - 1];
+		const int e[3] = {c[0] - p.red, c[1] - p.green, c[2] - p.blue};
+		for(int k = 0; k < 3; k++) {
+			ce[3 + k] += e[k];
+			ce[6 + k] += e[k];
+			ne[-3 + k] += e[k];
+			ne[k] += e[k];
+			ne[3 + k] += e[k];
+			ae[k] += e[k];
+		}
+	}
+	std::fill(errors[0].begin(), errors[0].end(), 0);
+	std::rotate(errors, errors + 1, errors + 3);
+}
+
+void ditherer::row(diagnostics &diag, const uint8_t *in, uint8_t *out, png_uint_32 y) {
+	if(mode == TCC_DITHER_ORDERED)
+		ordered(diag, in, out, y);
+	else if(mode == TCC_DITHER_FLOYD)
+		floyd(diag, in, out, y);
+	else
+		atkinson(diag, in, out, y);
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "internal.hpp"
+
+//Palettizes RGBA rows to nearest palette colors with dithering, rows come in order
+//Colors already in palette are kept exactly and do not spread error
+class ditherer {
+public:
+	ditherer(const tcc_palette &plt, int mode, png_uint_32 width);
+	ditherer(const ditherer&) = delete;
+	ditherer &operator =(const ditherer&) = delete;
+
+	void row(diagnostics &diag, const uint8_t *in, uint8_t *out, png_uint_32 y);
+
+private:
+	static unsigned cell(int r, int g, int b) {
+		return (r >> 3) << 10 | (g >> 3) << 5 | b >> 3;
+	}
+	uint8_t nearest(int r, int g, int b) const {
+		return cube[cell(r, g, b)];
+	}
+	bool fixed(diagnostics &diag, const uint8_t *px, uint8_t &out, png_uint_32 x, png_uint_32 y) const;
+	void ordered(diagnostics &diag, const uint8_t *in, uint8_t *out, png_uint_32 y);
+	void floyd(diagnostics &diag, const uint8_t *in, uint8_t *out, png_uint_32 y);
+	void atkinson(diagnostics &diag, const uint8_t *in, uint8_t *out, png_uint_32 y);
+
+	const tcc_palette &plt;
+	int mode;
+	png_uint_32 width;
+	//Output index nearest to center of every cell of RGB cube with 5 bits per channel
+	std::vector<uint8_t> cube;
+	//Cells holding palette colors, only their pixels can be exact
+	std::vector<uint8_t> exact;
+	//Scaled errors for current and next rows, RGB per pixel with 2 pixels of padding on both sides
+	std::vector<int16_t> errors[3];
+};
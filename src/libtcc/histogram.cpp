@@ -0,0 +1,173 @@
+#include "histogram.hpp"
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <new>
+#include <string>
+
+//Limit of tile counters kept in memory, 128K tiles of 256 64 bit counters
+static constexpr size_t MAXTILEBYTES = (size_t)256 << 20;
+
+static int64_t floorto(int64_t v, int64_t step) {
+	return (v >= 0 ? v : v - step + 1) / step * step;
+}
+
+int histogram::init(const mappedpng &output, uint32_t tile, size_t inputs, diagnostics &diag) {
+	offset = output.offset;
+	width = output.x;
+	height = output.y;
+	this->tile = tile;
+	numinputs = inputs;
+	palette.assign(output.paletted.plt, output.paletted.plt + output.paletted.numcolors);
+	if(tile) {
+		origin = {(png_int_32)floorto(offset.x, tile), (png_int_32)floorto(offset.y, tile)};
+		cols = ((int64_t)offset.x + width - origin.x + tile - 1) / tile;
+		rows = ((int64_t)offset.y + height - origin.y + tile - 1) / tile;
+	} else {
+		origin = offset;
+		cols = rows = 1;
+	}
+	//Split counters of every column come out of the same budget
+	const size_t colbytes = sizeof(*split.get()) * 4;
+	if(cols > MAXTILEBYTES / colbytes || rows > (MAXTILEBYTES - cols * colbytes) / (cols * sizeof(*tiles.get()))) {
+		diag.error("Histogram tile %" PRIu32 " is too small for %" PRIu32 "x%" PRIu32 " output, %zu tiles exceed %zu MiB of counters",
+			tile, width, height, cols * rows, MAXTILEBYTES >> 20);
+		return -ERANGE;
+	}
+	//Column never gets more than colwidth pixels per row
+	uint64_t colwidth = tile ? std::min<uint64_t>(tile, width) : width;
+	flushrows = std::max<uint64_t>(1, UINT32_MAX / colwidth);
+	split.reset(new(std::nothrow) uint32_t[cols * 4][256]());
+	tiles.reset(new(std::nothrow) uint64_t[cols * rows][256]());
+	this->inputs.reset(new(std::nothrow) uint64_t[std::max<size_t>(inputs, 1)][256]());
+	if(!split || !tiles || !this->inputs) {
+		diag.error("Out of memory");
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+void histogram::flush() {
+	size_t tilerow = tile ? ((int64_t)offset.y + y - 1 - origin.y) / tile : 0;
+	for(size_t c = 0; c < cols; c++) {
+		uint64_t *total = tiles[tilerow * cols + c];
+		for(size_t k = 0; k < 4; k++) {
+			uint32_t *counts = split[c * 4 + k];
+			for(size_t v = 0; v < 256; v++)
+				total[v] += counts[v];
+			std::fill(counts, counts + 256, 0);
+		}
+	}
+	pending = 0;
+}
+
+void histogram::row(const uint8_t *row) {
+	size_t x = 0;
+	for(size_t c = 0; c < cols; c++) {
+		size_t end = tile ? std::min<int64_t>(width, (int64_t)origin.x + (c + 1) * tile - offset.x) : width;
+		histrow<uint32_t, 4>(split.get() + c * 4, row + x, end - x);
+		x = end;
+	}
+	y++;
+	pending++;
+	if(y == height || pending == flushrows || (tile && ((int64_t)offset.y + y - origin.y) % tile == 0))
+		flush();
+}
+
+static void jsonstring(std::string &out, const char *s) {
+	out += '"';
+	for(; *s; s++) {
+		unsigned char c = *s;
+		if(c == '"' || c == '\\') {
+			out += '\\';
+			out += c;
+		} else if(c < 0x20) {
+			char esc[8];
+			snprintf(esc, sizeof(esc), "\\u%04x", c);
+			out += esc;
+		} else
+			out += c;
+	}
+	out += '"';
+}
+
+//Counts up to end of palette or last nonzero index past it
+static void jsoncounts(std::string &out, const uint64_t *counts, size_t numcolors) {
+	size_t n = 256;
+	for(; n > numcolors && counts[n - 1] == 0; n--);
+	out += '[';
+	for(size_t i = 0; i < n; i++) {
+		char num[24];
+		snprintf(num, sizeof(num), i ? ",%" PRIu64 : "%" PRIu64, counts[i]);
+		out += num;
+	}
+	out += ']';
+}
+
+static void jsonrect(std::string &out, int64_t x, int64_t y, uint64_t w, uint64_t h) {
+	char buf[96];
+	snprintf(buf, sizeof(buf), "\"x\":%" PRIi64 ",\"y\":%" PRIi64 ",\"width\":%" PRIu64 ",\"height\":%" PRIu64, x, y, w, h);
+	out += buf;
+}
+
+int histogram::write(tcc_sink &sink, std::span<mappedio* const> names, diagnostics &diag) {
+	std::string out;
+	try {
+		out += '{';
+		jsonrect(out, offset.x, offset.y, width, height);
+		out += ",\"palette\":[";
+		for(size_t i = 0; i < palette.size(); i++) {
+			char color[16];
+			snprintf(color, sizeof(color), i ? ",\"#%02x%02x%02x\"" : "\"#%02x%02x%02x\"", palette[i].red, palette[i].green, palette[i].blue);
+			out += color;
+		}
+		uint64_t total[256] = {};
+		for(size_t t = 0; t < cols * rows; t++)
+			for(size_t v = 0; v < 256; v++)
+				total[v] += tiles[t][v];
+		out += "],\n\"total\":";
+		jsoncounts(out, total, palette.size());
+		if(tile) {
+			//Only tiles with opaque pixels
+			out += ",\n\"tile\":" + std::to_string(tile) + ",\n\"tiles\":[";
+			bool first = true;
+			for(size_t r = 0; r < rows; r++)
+				for(size_t c = 0; c < cols; c++) {
+					const uint64_t *counts = tiles[r * cols + c];
+					if(std::all_of(counts + 1, counts + 256, [](uint64_t v) { return v == 0; }))
+						continue;
+					int64_t left = std::max<int64_t>(origin.x + (int64_t)c * tile, offset.x);
+					int64_t top = std::max<int64_t>(origin.y + (int64_t)r * tile, offset.y);
+					int64_t right = std::min<int64_t>(origin.x + (int64_t)(c + 1) * tile, (int64_t)offset.x + width);
+					int64_t bottom = std::min<int64_t>(origin.y + (int64_t)(r + 1) * tile, (int64_t)offset.y + height);
+					out += first ? "\n{" : ",\n{";
+					first = false;
+					jsonrect(out, left, top, right - left, bottom - top);
+					out += ",\"counts\":";
+					jsoncounts(out, counts, palette.size());
+					out += '}';
+				}
+			out += ']';
+		}
+		if(!names.empty()) {
+			out += ",\n\"inputs\":[";
+			for(size_t i = 0; i < names.size() && i < numinputs; i++) {
+				const mappedpng &png = names[i]->png;
+				out += i ? ",\n{\"name\":" : "\n{\"name\":";
+				jsonstring(out, names[i]->name);
+				out += ',';
+				jsonrect(out, png.offset.x, png.offset.y, png.x, png.y);
+				out += ",\"counts\":";
+				jsoncounts(out, inputs[i], palette.size());
+				out += '}';
+			}
+			out += ']';
+		}
+		out += "}\n";
+	} catch(const std::bad_alloc&) {
+		diag.error("Out of memory");
+		return -ENOMEM;
+	}
+	return writeblob(sink, out.data(), out.size(), diag);
+}
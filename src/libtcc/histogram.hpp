@@ -0,0 +1,40 @@
+#pragma once
+
+#include "internal.hpp"
+#include "rowops.hpp"
+
+#include <memory>
+
+//Palette index counts of streamed rows, written as JSON
+//Output rows are counted per tile of grid aligned to canvas coordinates,
+//so grids of different outputs line up
+class histogram {
+public:
+	histogram() = default;
+	histogram(const histogram&) = delete;
+	histogram &operator =(const histogram&) = delete;
+
+	//Tile 0 keeps only totals, inputs is number of input() indices
+	int init(const mappedpng &output, uint32_t tile, size_t inputs, diagnostics &diag);
+	//Row of input N
+	void input(size_t i, const uint8_t *row, size_t n) {
+		histrow<uint64_t, 1>(inputs.get() + i, row, n);
+	}
+	//Next output row
+	void row(const uint8_t *row);
+	//Input N is named by names[N]
+	int write(tcc_sink &sink, std::span<mappedio* const> names, diagnostics &diag);
+
+private:
+	void flush();
+
+	v2i32 offset, origin;//Of output and first tile
+	png_uint_32 width, height;
+	uint32_t tile;
+	size_t cols, rows, numinputs;
+	png_uint_32 y = 0, pending = 0, flushrows;
+	std::vector<color_t> palette;
+	//4 split counters per tile column, flushed before they can overflow
+	std::unique_ptr<uint32_t[][256]> split;
+	std::unique_ptr<uint64_t[][256]> tiles, inputs;
+};
@@ -0,0 +1,364 @@
+#include "chunks.hpp"
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdlib>
+#include <zlib.h>
+
+//Sidecar index of deflate restart points, like zlib's zran example
+//Decoding can start at any point with its window and the unfiltered row preceding it
+
+static const uint8_t indexmagic[8] = {'T', 'C', 'C', 'I', 'D', 'X', '1', 0};
+static constexpr size_t WINSIZE = 32768;
+
+struct restartpoint {
+	uint64_t in;//IDAT payload offset of first whole byte after point
+	uint64_t out;//Offset in filtered row stream
+	uint32_t row;//First whole row after point
+	uint8_t bits;//Low bits of byte before in that belong to the point
+	uint32_t window;//Bytes of window in state
+	//Window followed by previous unfiltered row, compressed in index
+	std::vector<uint8_t> state;
+	const uint8_t *packed;
+	uint32_t packedsize;
+};
+
+static int checkheader(const pngheader &hdr, const char *name, diagnostics &diag) {
+	if(hdr.depth != 8 || hdr.interlace != PNG_INTERLACE_NONE) {
+		diag.error("%s must be 8 bit and not interlaced", name);
+		return -EINVAL;
+	}
+	return 0;
+}
+
+//Position IDAT stream at zlib header and skip it
+static int skipzlib(idatstream &idat, const char *name, diagnostics &diag) {
+	uint8_t zhdr[2];
+	if(idat.seek(0) != 0 || idat.read(zhdr, 2) != 2 || (zhdr[0] & 0x0F) != Z_DEFLATED
+			|| (zhdr[0] << 8 | zhdr[1]) % 31 != 0 || (zhdr[1] & 0x20)) {
+		diag.error("Unsupported image data in %s", name);
+		return -EINVAL;
+	}
+	return 0;
+}
+
+static int buildindex(const tcc_source *src, const tcc_index_options *opt, tcc_sink *sink, diagnostics &diag) {
+	uint32_t span = opt && opt->span ? opt->span : 64;
+	bytesource in;
+	pngheader hdr;
+	int err = in.open(*src, diag);
+	if(err == 0)
+		err = readheader(in, hdr, true, diag);
+	if(err == 0)
+		err = checkheader(hdr, in.name(), diag);
+	idatstream idat(in, hdr);
+	if(err == 0)
+		err = skipzlib(idat, in.name(), diag);
+	if(err != 0)
+		return err;
+
+	unsigned bpp = hdr.bpp();
+	size_t stride = (size_t)hdr.width * bpp, rowlen = stride + 1;
+	z_stream strm = {};
+	if(inflateInit2(&strm, -15) != Z_OK)
+		return -ENOMEM;
+	std::vector<restartpoint> points(1);
+	points[0] = {2, 0, 0, 0, 0, std::vector<uint8_t>(stride), nullptr, 0};
+	std::vector<uint8_t> window(WINSIZE), row(rowlen), prev(stride);
+	std::vector<uint8_t> input(65536);
+	uint64_t in_total = 2, out_total = 0;
+	size_t fill = 0, pending = 1;
+	uint32_t y = 0;
+	int ret = Z_OK;
+	while(ret != Z_STREAM_END && y < hdr.height) {
+		if(strm.avail_in == 0) {
+			strm.next_in = input.data();
+			strm.avail_in = idat.read(input.data(), input.size());
+			if(strm.avail_in == 0) {
+				diag.error("%s is truncated", in.name());
+				err = -EIO;
+				break;
+			}
+		}
+		//Window is inflate output, it wraps around every 32K
+		size_t wpos = out_total % WINSIZE;
+		strm.next_out = window.data() + wpos;
+		strm.avail_out = WINSIZE - wpos;
+		uInt avail = strm.avail_in;
+		ret = inflate(&strm, Z_BLOCK);
+		if(ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+			diag.error("Corrupt image data in %s", in.name());
+			err = -EIO;
+			break;
+		}
+		in_total += avail - strm.avail_in;
+		size_t produced = WINSIZE - wpos - strm.avail_out;
+		const uint8_t *p = window.data() + wpos;
+		out_total += produced;
+
+		//Reconstruct rows to know previous row at each point
+		while(produced != 0 && y < hdr.height) {
+			size_t n = std::min(produced, rowlen - fill);
+			memcpy(row.data() + fill, p, n);
+			fill += n;
+			p += n;
+			produced -= n;
+			if(fill < rowlen)
+				continue;
+			if(!unfilter(row[0], row.data() + 1, prev.data(), stride, bpp)) {
+				diag.error("Invalid row filter in %s", in.name());
+				err = -EIO;
+				break;
+			}
+			memcpy(prev.data(), row.data() + 1, stride);
+			fill = 0;
+			y++;
+			for(; pending < points.size() && points[pending].row == y; pending++)
+				points[pending].state.insert(points[pending].state.end(), prev.begin(), prev.end());
+		}
+		if(err != 0)
+			break;
+
+		//Block boundary, not after last block
+		if((strm.data_type & 128) && !(strm.data_type & 64) && out_total - points.back().out >= (uint64_t)span * rowlen) {
+			restartpoint pt = {in_total, out_total, (uint32_t)((out_total + rowlen - 1) / rowlen), (uint8_t)(strm.data_type & 7), 0, {}, nullptr, 0};
+			if(pt.row >= hdr.height)
+				continue;
+			size_t end = out_total % WINSIZE;
+			if(out_total >= WINSIZE)
+				pt.state.insert(pt.state.end(), window.begin() + end, window.end());
+			pt.state.insert(pt.state.end(), window.begin(), window.begin() + end);
+			pt.window = pt.state.size();
+			if(pt.row == y)
+				pt.state.insert(pt.state.end(), prev.begin(), prev.end());
+			points.push_back(std::move(pt));
+			if(pending == points.size() - 1 && points.back().row == y)
+				pending++;
+		}
+	}
+	inflateEnd(&strm);
+	if(err == 0 && y < hdr.height) {
+		diag.error("%s is truncated", in.name());
+		err = -EIO;
+	}
+	if(err != 0)
+		return err;
+
+	std::vector<uint8_t> out(indexmagic, indexmagic + sizeof(indexmagic));
+	putle(out, hdr.width, 4);
+	putle(out, hdr.height, 4);
+	putle(out, bpp, 4);
+	putle(out, span, 4);
+	putle(out, hdr.datasize, 8);
+	putle(out, hdr.idatcrc, 4);
+	putle(out, points.size(), 4);
+	std::vector<uint8_t> packed;
+	for(const restartpoint &pt : points) {
+		uLongf size = compressBound(pt.state.size());
+		packed.resize(size);
+		if(compress2(packed.data(), &size, pt.state.data(), pt.state.size(), Z_BEST_SPEED) != Z_OK)
+			return -ENOMEM;
+		putle(out, pt.in, 8);
+		putle(out, pt.out, 8);
+		putle(out, pt.row, 4);
+		putle(out, pt.bits, 4);
+		putle(out, pt.window, 4);
+		putle(out, size, 4);
+		out.insert(out.end(), packed.begin(), packed.begin() + size);
+	}
+	err = writeblob(*sink, out.data(), out.size(), diag);
+	if(err == 0)
+		diag.info("Info: indexed %s with %zu restart points every %" PRIu32 " rows, %zu bytes",
+			in.name(), points.size(), span, out.size());
+	return err;
+}
+
+int tcc_index(const tcc_source *src, const tcc_index_options *opt, tcc_sink *sink) {
+	diagnostics diag(opt ? opt->log : nullptr);
+	return guarded(diag, [&]() {
+		return buildindex(src, opt, sink, diag);
+	});
+}
+
+static int loadindex(std::span<const uint8_t> data, const pngheader &hdr, std::vector<restartpoint> &points) {
+	const uint8_t *p = data.data(), *end = p + data.size();
+	if(data.size() < 40 || memcmp(p, indexmagic, sizeof(indexmagic)) != 0)
+		return -EINVAL;
+	p += sizeof(indexmagic);
+	uint32_t width = getle(p, 4), height = getle(p, 4), bpp = getle(p, 4);
+	getle(p, 4);
+	uint64_t datasize = getle(p, 8);
+	uint32_t crc = getle(p, 4), count = getle(p, 4);
+	if(width != hdr.width || height != hdr.height || bpp != hdr.bpp() || datasize != hdr.datasize || crc != hdr.idatcrc || count == 0)
+		return -EINVAL;
+	points.resize(count);
+	for(restartpoint &pt : points) {
+		if(end - p < 32)
+			return -EINVAL;
+		pt.in = getle(p, 8);
+		pt.out = getle(p, 8);
+		pt.row = getle(p, 4);
+		pt.bits = getle(p, 4);
+		pt.window = getle(p, 4);
+		pt.packedsize = getle(p, 4);
+		pt.packed = p;
+		if((size_t)(end - p) < pt.packedsize || pt.window > WINSIZE || pt.bits > 7 || pt.row >= height)
+			return -EINVAL;
+		p += pt.packedsize;
+	}
+	return 0;
+}
+
+//Pull-style inflate of IDAT stream
+class inflater {
+public:
+	inflater(idatstream &idat) : idat(idat) {}
+	~inflater() {
+		if(ready)
+			inflateEnd(&strm);
+	}
+	int start(const restartpoint &pt) {
+		if(inflateInit2(&strm, -15) != Z_OK)
+			return -ENOMEM;
+		ready = true;
+		if(idat.seek(pt.in - (pt.bits ? 1 : 0)) != 0)
+			return -EIO;
+		if(pt.bits) {
+			uint8_t c;
+			if(idat.read(&c, 1) != 1)
+				return -EIO;
+			inflatePrime(&strm, pt.bits, c >> (8 - pt.bits));
+		}
+		if(pt.window && inflateSetDictionary(&strm, pt.state.data(), pt.window) != Z_OK)
+			return -EIO;
+		return 0;
+	}
+	int read(uint8_t *buf, size_t n) {
+		strm.next_out = buf;
+		strm.avail_out = n;
+		while(strm.avail_out) {
+			if(strm.avail_in == 0) {
+				strm.next_in = input;
+				strm.avail_in = idat.read(input, sizeof(input));
+				if(strm.avail_in == 0)
+					return -EIO;
+			}
+			int ret = inflate(&strm, Z_NO_FLUSH);
+			if(ret != Z_OK && !(ret == Z_STREAM_END && strm.avail_out == 0))
+				return -EIO;
+		}
+		return 0;
+	}
+
+private:
+	idatstream &idat;
+	z_stream strm = {};
+	bool ready = false;
+	uint8_t input[16384];
+};
+
+static int cropregion(const tcc_source *src, const tcc_source *index, const tcc_crop_options *opt, tcc_sink *sink, diagnostics &diag) {
+	bytesource in, idx;
+	pngheader hdr;
+	int err = in.open(*src, diag);
+	if(err == 0)
+		err = readheader(in, hdr, true, diag);
+	if(err == 0)
+		err = checkheader(hdr, in.name(), diag);
+	if(err != 0)
+		return err;
+	std::vector<uint8_t> data;
+	std::vector<restartpoint> points;
+	err = idx.open(*index, diag);
+	if(err == 0)
+		err = idx.readall(data);
+	if(err == 0 && loadindex(data, hdr, points) != 0) {
+		diag.error("Index %s does not match %s, rebuild it", idx.name(), in.name());
+		err = -EINVAL;
+	}
+	if(err != 0)
+		return err;
+
+	//Region in image coordinates
+	int64_t left = std::max<int64_t>((int64_t)opt->x - hdr.offset.x, 0);
+	int64_t top = std::max<int64_t>((int64_t)opt->y - hdr.offset.y, 0);
+	int64_t right = std::min<int64_t>((int64_t)opt->x - hdr.offset.x + opt->width, hdr.width);
+	int64_t bottom = std::min<int64_t>((int64_t)opt->y - hdr.offset.y + opt->height, hdr.height);
+	if(left >= right || top >= bottom) {
+		diag.error("Region is outside of %s", in.name());
+		return -ERANGE;
+	}
+
+	//Nearest point at or above region
+	auto it = std::upper_bound(points.begin(), points.end(), (uint32_t)top,
+		[](uint32_t y, const restartpoint &pt) { return y < pt.row; });
+	restartpoint &pt = *--it;
+	unsigned bpp = hdr.bpp();
+	size_t stride = (size_t)hdr.width * bpp, rowlen = stride + 1;
+	uLongf size = pt.window + stride;
+	pt.state.resize(size);
+	if(uncompress(pt.state.data(), &size, pt.packed, pt.packedsize) != Z_OK || size != pt.window + stride) {
+		diag.error("Index %s is corrupt", idx.name());
+		return -EINVAL;
+	}
+	idatstream idat(in, hdr);
+	inflater z(idat);
+	std::vector<uint8_t> row(rowlen), prev(pt.state.begin() + pt.window, pt.state.end());
+	err = z.start(pt);
+	//Tail of row before point
+	for(uint64_t skip = (uint64_t)pt.row * rowlen - pt.out; err == 0 && skip != 0;) {
+		size_t n = std::min<uint64_t>(skip, rowlen);
+		err = z.read(row.data(), n);
+		skip -= n;
+	}
+	if(err != 0) {
+		diag.error("Failed to seek in %s", in.name());
+		return err;
+	}
+
+	mappedio out;
+	mappedpng &output = out.png;
+	output.x = right - left;
+	output.y = bottom - top;
+	output.colorType = hdr.colortype;
+	output.bitDepth = 8;
+	output.offset = hdr.offset + v2i32{(png_int_32)left, (png_int_32)top};
+	output.write = true;
+	//Palette alpha or color key of gray and RGB images
+	output.paletted.plt = hdr.plt;
+	output.paletted.numcolors = hdr.numcolors;
+	output.paletted.alpha = hdr.trns;
+	output.paletted.numtransparent = hdr.numtrns;
+	err = opensink(*sink, out, diag);
+	if(err != 0)
+		return err;
+	for(int64_t y = pt.row; y < bottom && err == 0; y++) {
+		err = z.read(row.data(), rowlen);
+		if(err != 0) {
+			diag.error("Corrupt image data in %s", in.name());
+			break;
+		}
+		if(!unfilter(row[0], row.data() + 1, prev.data(), stride, bpp)) {
+			diag.error("Invalid row filter in %s", in.name());
+			err = -EIO;
+			break;
+		}
+		if(y >= top)
+			err = writerow(&output, row.data() + 1 + left * bpp);
+		memcpy(prev.data(), row.data() + 1, stride);
+	}
+	err = closesink(*sink, out, err);
+	if(err == 0)
+		diag.info("Info: decoded %" PRIi64 " rows of %s from row %" PRIu32, bottom - pt.row, in.name(), pt.row);
+	return err;
+}
+
+int tcc_crop(const tcc_source *src, const tcc_source *index, const tcc_crop_options *opt, tcc_sink *sink) {
+	const tcc_crop_options defaults = {};
+	if(!opt)
+		opt = &defaults;
+	diagnostics diag(opt->log);
+	return guarded(diag, [&]() {
+		return cropregion(src, index, opt, sink, diag);
+	});
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+#include "common/png.h"
+#include "tcc.h"
+#include "diag.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <span>
+#include <stdexcept>
+#include <system_error>
+#include <vector>
+
+typedef png_color color_t;
+
+constexpr inline bool operator ==(const color_t &a, const color_t &b) {
+	return a.red == b.red && a.green == b.green && a.blue == b.blue;
+}
+
+constexpr inline v2i32 operator +(const v2i32 &a, const v2i32 &b) {
+	return {a.x + b.x, a.y + b.y};
+}
+
+constexpr inline v2i32 operator -(const v2i32 &a, const v2i32 &b) {
+	return {a.x - b.x, a.y - b.y};
+}
+
+constexpr inline bool operator <(const v2i32 &a, const v2i32 &b) {
+	return a.x < b.x && a.y < b.y;
+}
+constexpr inline bool operator >(const v2i32 &a, const v2i32 &b) {
+	return a.x > b.x && a.y > b.y;
+}
+
+constexpr inline v2i32 minel(const v2i32 &a, const v2i32 &b) {
+	return {a.x < b.x ? a.x : b.x, a.y < b.y ? a.y : b.y};
+}
+constexpr inline v2i32 maxel(const v2i32 &a, const v2i32 &b) {
+	return {a.x > b.x ? a.x : b.x, a.y > b.y ? a.y : b.y};
+}
+
+constexpr inline uint32_t packrgb(const color_t &c) {
+	return (uint32_t)c.red << 16 | (uint32_t)c.green << 8 | c.blue;
+}
+
+inline uint32_t packrgba(uint8_t r, uint8_t g, uint8_t b, uint8_t a) {
+	//Memory order is RGBA
+	uint8_t px[4] = {r, g, b, a};
+	uint32_t v;
+	memcpy(&v, px, 4);
+	return v;
+}
+
+//Find first and last opaque index of compiled row, false when row is fully transparent
+inline bool rowbounds(const uint8_t *row, size_t width, size_t &first, size_t &last) {
+	size_t i = 0, j = width;
+	uint64_t word;
+	//Skip transparent runs word at a time
+	for(; j - i >= 8; i += 8) {
+		memcpy(&word, row + i, 8);
+		if(word)
+			break;
+	}
+	for(; i < j && row[i] == 0; i++);
+	if(i == j)
+		return false;
+	for(; j - i >= 8; j -= 8) {
+		memcpy(&word, row + j - 8, 8);
+		if(word)
+			break;
+	}
+	for(; row[j - 1] == 0; j--);
+	first = i;
+	last = j - 1;
+	return true;
+}
+
+//Opaque bounding box, empty when left > right
+struct bbox {
+	png_int_32 left = INT32_MAX, right = INT32_MIN, top = INT32_MAX, bottom = INT32_MIN;
+
+	void addrow(png_int_32 y, size_t first, size_t last) {
+		left = std::min(left, (png_int_32)first);
+		right = std::max(right, (png_int_32)last);
+		top = std::min(top, y);
+		bottom = std::max(bottom, y);
+	}
+	bool empty() const {
+		return left > right;
+	}
+};
+
+struct tcc_palette {
+	//Without transparent color, index in output is position + 1
+	std::vector<color_t> colors;
+	//Open addressing table of packrgb(color) << 8 | output index, 0 is empty
+	std::array<uint32_t, 512> table;
+
+	void rebuild();
+	//Output index or 0 when color is not in palette
+	uint8_t find(uint32_t rgb) const {
+		for(uint32_t h = (rgb * 2654435761u) >> 23;; h = (h + 1) & 511) {
+			uint32_t e = table[h];
+			if(e == 0)
+				return 0;
+			if(e >> 8 == rgb)
+				return e & 0xFF;
+		}
+	}
+};
+
+//Get palette-to-palette table
+//Output plt color 0 is transparent
+int plt2pltTable(diagnostics &diag, std::span<const color_t> input, std::span<const uint8_t> inputAlpha, std::vector<color_t> &outputPlt, bool allowGrowth, std::vector<uint8_t> &pltpair);
+
+//Run body of C entry point, exceptions must not cross C boundary
+//Thread creation throws system_error, sizing from input data throws bad_alloc or length_error
+template<class body>
+int guarded(diagnostics &diag, body &&run) {
+	try {
+		return run();
+	} catch(const std::system_error &e) {
+		diag.error("Failed to start thread: %s", e.what());
+		return -EAGAIN;
+	} catch(const std::bad_alloc&) {
+		diag.error("Out of memory");
+		return -ENOMEM;
+	} catch(const std::length_error&) {
+		diag.error("Out of memory");
+		return -ENOMEM;
+	} catch(const std::exception &e) {
+		diag.error("%s", e.what());
+		return -EINVAL;
+	}
+}
+
+//Input or output stream of tcc_source/tcc_sink
+struct mappedio {
+	mappedpng png;
+	mapbuf buf;
+	const char *name;
+};
+
+//Read whole image into malloc'ed buffer
+int readPNG(mappedpng &png, png_bytep &data);
+
+int opensource(const tcc_source &src, mappedio &io, diagnostics &diag);
+int opensink(tcc_sink &sink, mappedio &io, diagnostics &diag);
+//Finish output and hand memory buffer over to sink, err discards output
+int closesink(tcc_sink &sink, mappedio &io, int err);
+//Write non-PNG output in one go, memory is allocated with malloc
+int writeblob(tcc_sink &sink, const void *data, size_t size, diagnostics &diag);
+
+//RGBA of paletted image with tRNS composited over background, indices past palette are background
+void buildlut(const mappedpng &png, const uint8_t bg[4], uint32_t lut[256]);
@@ -0,0 +1,102 @@
+#include "internal.hpp"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+int readPNG(mappedpng &png, png_bytep &data) {
+	size_t stride = png.colorType == PNG_COLOR_TYPE_RGB ? 3 : (png.colorType == PNG_COLOR_TYPE_PALETTE ? 1 : 4);
+	std::vector<png_bytep> rows(png.y);
+	data = (png_bytep)malloc((size_t)png.x * png.y * stride);
+	if(!data)
+		return -ENOMEM;
+	size_t offset = 0;
+	for(png_uint_32 i = 0; i < png.y; i++) {
+		rows[i] = data + offset;
+		offset += png.x * stride;
+	}
+	int err = readimage(&png, rows.data());
+	if(err != 0) {
+		free(data);
+		data = nullptr;
+	}
+	return err;
+}
+
+int opensource(const tcc_source &src, mappedio &io, diagnostics &diag) {
+	io.buf = {};
+	if(src.path) {
+		io.name = src.path;
+		return map(src.path, &io.png, diag.log());
+	}
+	if(!src.data) {
+		diag.error("Source has neither path nor data");
+		return -EINVAL;
+	}
+	io.name = "memory buffer";
+	io.buf.data = (png_bytep)src.data;
+	io.buf.size = src.size;
+	return mapmem(&io.buf, &io.png, diag.log());
+}
+
+int opensink(tcc_sink &sink, mappedio &io, diagnostics &diag) {
+	io.buf = {};
+	io.name = sink.path ? sink.path : "memory buffer";
+	return mapwrite(sink.path, sink.path ? nullptr : &io.buf, &io.png, diag.log());
+}
+
+int closesink(tcc_sink &sink, mappedio &io, int err) {
+	int ret = unmapwrite(&io.png);
+	if(err == 0)
+		err = ret;
+	if(sink.path)
+		return err;
+	if(err != 0) {
+		free(io.buf.data);
+		io.buf = {};
+		return err;
+	}
+	sink.data = io.buf.data;
+	sink.size = io.buf.size;
+	return 0;
+}
+
+int writeblob(tcc_sink &sink, const void *data, size_t size, diagnostics &diag) {
+	if(!sink.path) {
+		sink.data = malloc(size ? size : 1);
+		if(!sink.data)
+			return -ENOMEM;
+		memcpy(sink.data, data, size);
+		sink.size = size;
+		return 0;
+	}
+	const bool stdio = sink.path[0] == '-' && sink.path[1] == '\0';
+	FILE *f = stdio ? stdout : fopen(sink.path, "wb");
+	if(!f) {
+		int err = -errno;
+		diag.error("Failed to open for write \"%s\"", sink.path);
+		return err;
+	}
+#ifdef _WIN32
+	if(stdio)
+		_setmode(_fileno(stdout), _O_BINARY);
+#endif
+	int err = fwrite(data, 1, size, f) == size ? 0 : -EIO;
+	if((stdio ? fflush(f) : fclose(f)) != 0 && err == 0)
+		err = -errno;
+	if(err != 0)
+		diag.error("Failed to write %s", sink.path);
+	return err;
+}
+
+void tcc_free(void *data) {
+	free(data);
+}
+
+const char *tcc_strerror(int err) {
+	return strerror(-err);
+}
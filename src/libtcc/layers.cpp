@@ -0,0 +1,212 @@
+#include "internal.hpp"
+#include "rowops.hpp"
+
+#include <cerrno>
+#include <cinttypes>
+
+//Image or mask of layer, expanded to RGBA row by row
+struct plane {
+	mappedio io = {};
+	bool mask;
+	//Mask colors are scaled and pixels made opaque
+	bool darken;
+	//May have pixels that are neither transparent nor opaque
+	bool partial;
+	uint8_t scale[256];
+	uint32_t lut[256];//Of paletted image
+	std::vector<uint8_t> raw;//Paletted or RGB row
+	std::vector<uint32_t> row;
+};
+
+//Composed output, only span painted by previous row is cleared
+struct composed {
+	mappedio io = {};
+	std::vector<uint32_t> row;
+	size_t left = 0, right = 0;
+	bool open = false;
+};
+
+static int openplane(const tcc_source &src, plane &p, bool mask, float factor, diagnostics &diag) {
+	int err = opensource(src, p.io, diag);
+	if(err != 0)
+		return err;
+	const mappedpng &png = p.io.png;
+	p.mask = mask;
+	p.darken = mask && factor != 1;
+	p.partial = png.colorType == PNG_COLOR_TYPE_RGBA;
+	if(p.darken)
+		for(int v = 0; v < 256; v++)
+			p.scale[v] = std::clamp(v * factor, 0.f, 255.f);
+	if(png.colorType == PNG_COLOR_TYPE_PALETTE) {
+		const uint8_t transparent[4] = {};
+		buildlut(png, transparent, p.lut);
+		for(uint32_t &c : p.lut) {
+			uint8_t px[4];
+			memcpy(px, &c, 4);
+			p.partial |= px[3] != 0 && px[3] != 255;
+			if(p.darken)
+				c = packrgba(p.scale[px[0]], p.scale[px[1]], p.scale[px[2]], 255);
+		}
+		//Darkened lookup is applied while expanding
+		p.darken = false;
+	}
+	try {
+		if(png.colorType != PNG_COLOR_TYPE_RGBA)
+			p.raw.resize((size_t)png.x * (png.colorType == PNG_COLOR_TYPE_RGB ? 3 : 1));
+		p.row.resize(png.x);
+	} catch(const std::bad_alloc&) {
+		diag.error("Out of memory");
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+static int readplane(plane &p) {
+	mappedpng &png = p.io.png;
+	if(png.colorType == PNG_COLOR_TYPE_RGBA) {
+		int err = readrow(&png, (png_bytep)p.row.data());
+		if(err != 0)
+			return err;
+	} else {
+		int err = readrow(&png, p.raw.data());
+		if(err != 0)
+			return err;
+		if(png.colorType == PNG_COLOR_TYPE_PALETTE)
+			expandrow(p.row.data(), p.raw.data(), p.lut, png.x);
+		else
+			for(size_t x = 0; x < png.x; x++)
+				p.row[x] = packrgba(p.raw[x * 3], p.raw[x * 3 + 1], p.raw[x * 3 + 2], 255);
+	}
+	if(p.darken)
+		for(uint32_t &c : p.row) {
+			uint8_t px[4];
+			memcpy(px, &c, 4);
+			c = packrgba(p.scale[px[0]], p.scale[px[1]], p.scale[px[2]], 255);
+		}
+	return 0;
+}
+
+static int composelayers(const tcc_layer *layers, size_t count, tcc_sink *output, tcc_sink *mask, diagnostics &diag) {
+	size_t numplanes = 0;
+	for(size_t i = 0; i < count; i++) {
+		if(!layers[i].image && !layers[i].mask) {
+			diag.error("Layer %zu has neither image nor mask", i);
+			return -EINVAL;
+		}
+		numplanes += (output && layers[i].image) + (mask && layers[i].mask);
+	}
+	if(numplanes == 0) {
+		diag.error("Nothing to compose");
+		return -EINVAL;
+	}
+
+	//Bottom to top, mappings keep pointers to their streams, so planes must not move
+	std::vector<plane> planes(numplanes);
+	int err = 0;
+	v2i32 min(INT32_MAX, INT32_MAX), max(INT32_MIN, INT32_MIN);
+	for(size_t i = 0, p = 0; i < count && err == 0; i++)
+		for(int m = 0; m < 2 && err == 0; m++) {
+			const tcc_source *src = m ? layers[i].mask : layers[i].image;
+			if(!src || !(m ? mask : output))
+				continue;
+			err = openplane(*src, planes[p], m, layers[i].maskfactor, diag);
+			const mappedpng &png = planes[p++].io.png;
+			if(err != 0)
+				break;
+			min = minel(min, png.offset);
+			max = maxel(max, png.offset + v2i32{(png_int_32)png.x, (png_int_32)png.y});
+		}
+
+	//Both outputs cover all layers, so they line up
+	composed outs[2];
+	tcc_sink *sinks[2] = {output, mask};
+	png_uint_32 width = 0, height = 0;
+	if(err == 0) {
+		width = max.x - min.x;
+		height = max.y - min.y;
+	}
+	for(int m = 0; m < 2 && err == 0; m++) {
+		if(!sinks[m])
+			continue;
+		mappedpng &png = outs[m].io.png;
+		png.x = width;
+		png.y = height;
+		png.colorType = PNG_COLOR_TYPE_RGBA;
+		png.bitDepth = 8;
+		png.offset = min;
+		png.write = true;
+		try {
+			outs[m].row.assign(width, 0);
+		} catch(const std::bad_alloc&) {
+			diag.error("Out of memory");
+			err = -ENOMEM;
+			break;
+		}
+		err = opensink(*sinks[m], outs[m].io, diag);
+		outs[m].open = err == 0;
+	}
+
+	//Semi-transparent pixels are composed as opaque, diagnostics would call them transparent
+	size_t partial = 0;
+	v2i32 partialat = {};
+	for(png_uint_32 y = 0; y < height && err == 0; y++) {
+		const int64_t cy = (int64_t)min.y + y;
+		for(composed &o : outs) {
+			if(o.right > o.left)
+				std::fill(o.row.begin() + o.left, o.row.begin() + o.right, 0);
+			o.left = width;
+			o.right = 0;
+		}
+		//Rows no layer touches stay cleared
+		for(plane &p : planes) {
+			const mappedpng &png = p.io.png;
+			if(cy < png.offset.y || cy >= (int64_t)png.offset.y + png.y)
+				continue;
+			err = readplane(p);
+			if(err != 0)
+				break;
+			composed &o = outs[p.mask];
+			const size_t x = png.offset.x - min.x;
+			size_t first, n;
+			if(!p.mask && p.partial && (n = partialrgba(p.row.data(), png.x, first))) {
+				if(partial == 0)
+					partialat = {(png_int_32)(x + first), (png_int_32)y};
+				partial += n;
+			}
+			n = paintrgba(o.row.data() + x, p.row.data(), png.x, first);
+			if(!p.mask && n)
+				diag.report(DIAG_CONFLICT, x + first, y, n);
+			o.left = std::min(o.left, x);
+			o.right = std::max(o.right, x + png.x);
+		}
+		for(int m = 0; m < 2 && err == 0; m++)
+			if(outs[m].open)
+				err = writerow(&outs[m].io.png, (png_const_bytep)outs[m].row.data());
+	}
+	for(int m = 0; m < 2; m++)
+		if(outs[m].open)
+			err = closesink(*sinks[m], outs[m].io, err);
+
+	for(plane &p : planes)
+		if(p.io.png.ptr) {
+			int ret = unmap(&p.io.png);
+			if(err == 0)
+				err = ret;
+		}
+	if(partial)
+		diag.warn("%zu semi-transparent pixels are composed as opaque, first at (%" PRIi32 ",%" PRIi32 ")", partial, partialat.x, partialat.y);
+	if(err == 0)
+		diag.info("Info: composed %zu layers to %" PRIu32 "x%" PRIu32, count, width, height);
+	diag.summary(outs[0].open ? outs[0].io.name : "layers");
+	return err;
+}
+
+int tcc_layers(const tcc_layer *layers, size_t count, const tcc_layers_options *opt, tcc_sink *output, tcc_sink *mask) {
+	const tcc_layers_options defaults = {};
+	if(!opt)
+		opt = &defaults;
+	diagnostics diag(opt->log);
+	return guarded(diag, [&]() {
+		return composelayers(layers, count, output, mask, diag);
+	});
+}
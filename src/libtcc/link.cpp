@@ -0,0 +1,731 @@
+#include "arena.hpp"
+#include "histogram.hpp"
+#include "internal.hpp"
+#include "pipeline.hpp"
+#include "pyramid.hpp"
+#include "rowops.hpp"
+
+#include <algorithm>
+#include <barrier>
+#include <cerrno>
+#include <cstdlib>
+#include <cassert>
+#include <cinttypes>
+#include <memory.h>
+#include <thread>
+
+struct activemapping {
+	mappedpng *png;
+	png_bytep pixels;
+	v2i32 brc;
+	size_t index;//In sweep order
+//	bool collides;
+	constexpr bool operator <(const activemapping &b) const {
+		return png->offset.x < b.png->offset.x;
+	}
+};
+
+//Rows decoded in place by the sweep thread
+class directrows {
+public:
+	//Row buffer of input N is slots[N]
+	directrows(std::span<mappedpng*> inputs, std::span<const png_bytep> slots) : inputs(inputs), slots(slots) {}
+
+	int activate(size_t input, png_bytep &pixels) {
+		pixels = slots[input];
+		return 0;
+	}
+	int fetch(size_t input, png_bytep &pixels) {
+		return readrow(inputs[input], pixels);
+	}
+	void release(size_t) {}
+	int deactivate(size_t input, png_bytep) {
+		return unmap(inputs[input]);
+	}
+	void advance(png_int_32) {}
+
+private:
+	std::span<mappedpng*> inputs;
+	std::span<const png_bytep> slots;
+};
+
+//Conflicting pixels of pair of command line indices, a < b
+struct paircount {
+	size_t a, b;
+	uint64_t pixels;
+	constexpr bool operator <(const paircount &o) const {
+		return a < o.a || (a == o.a && b < o.b);
+	}
+};
+
+//State of one link sweep
+struct linkstate {
+	diagnostics &diag;
+	mappedpng &output;
+	png_bytep out;
+	//Command line index of inputs in sweep order, higher wins conflicts
+	std::span<const size_t> priority;
+	std::span<bbox> boxes;
+	//Conflict mask output or NULL
+	mappedpng *mask;
+	png_bytep maskrow;
+	bool maskdirty;
+	//Downscaled previews, may have no levels
+	pyramid &previews;
+	//Index counts or NULL
+	histogram *hist;
+	//Every pair of inputs with intersecting rectangles, sorted
+	std::vector<paircount> conflicts;
+	//Scratch for blendcluster
+	std::vector<const activemapping*> cluster;
+};
+
+//Paint overlapping mappings in command line order and count conflicting pixels of every pair
+static void blendcluster(linkstate &ls, png_int_32 y, std::span<const activemapping> ams, png_int_32 left, png_int_32 right) {
+	const png_int_32 base = ls.output.offset.x;
+	png_bytep out = ls.out;
+	memset(out + (left - base), 0, right - left);
+	std::vector<const activemapping*> &cluster = ls.cluster;
+	cluster.clear();
+	for(const activemapping &am : ams)
+		cluster.push_back(&am);
+	std::sort(cluster.begin(), cluster.end(), [&ls](const activemapping *a, const activemapping *b) {
+		return ls.priority[a->index] < ls.priority[b->index];
+	});
+	for(const activemapping *am : cluster)
+		paintrow(out + (am->png->offset.x - base), am->pixels, am->png->x);
+
+	for(size_t i = 0; i < cluster.size(); i++)
+		for(size_t j = i + 1; j < cluster.size(); j++) {
+			const activemapping &a = *cluster[i], &b = *cluster[j];
+			png_int_32 lo = std::max(a.png->offset.x, b.png->offset.x), hi = std::min(a.brc.x, b.brc.x);
+			if(lo >= hi)
+				continue;
+			size_t first;
+			png_bytep mask = ls.mask ? ls.maskrow + (lo - base) : nullptr;
+			size_t n = conflictrow(a.pixels + (lo - a.png->offset.x), b.pixels + (lo - b.png->offset.x), hi - lo, mask, first);
+			if(n == 0)
+				continue;
+			//Pairs were planned from rectangles, so this one is there
+			paircount key{ls.priority[a.index], ls.priority[b.index], 0};
+			std::lower_bound(ls.conflicts.begin(), ls.conflicts.end(), key)->pixels += n;
+			ls.diag.report(DIAG_CONFLICT, lo + first, y, n);
+			ls.maskdirty |= mask != nullptr;
+		}
+}
+
+//Compose row from active mappings sorted by x, gaps are transparent
+static void blendrow(linkstate &ls, png_int_32 y, const std::span<const activemapping> ams) {
+	const png_int_32 base = ls.output.offset.x;
+	png_bytep out = ls.out;
+	png_int_32 x = base;
+	for(size_t i = 0; i < ams.size();) {
+		//Find chain of overlapping mappings
+		size_t end = i + 1;
+		png_int_32 left = ams[i].png->offset.x, right = ams[i].brc.x;
+		for(; end < ams.size() && ams[end].png->offset.x < right; end++)
+			right = std::max(right, ams[end].brc.x);
+		memset(out + (x - base), 0, left - x);
+		if(end == i + 1)
+			std::copy(ams[i].pixels, ams[i].pixels + ams[i].png->x, out + (left - base));
+		else
+			blendcluster(ls, y, ams.subspan(i, end - i), left, right);
+		x = right;
+		i = end;
+	}
+	//Set rest to 0
+	memset(out + (x - base), 0, base + ls.output.x - x);
+}
+
+//Sweep rows top to bottom, emit gets active mappings of every row sorted by x
+template<class rowsource, class rowsink>
+static int sweeprows([[maybe_unused]] diagnostics &diag, std::span<bbox> boxes, png_int_32 top, png_int_32 bottom, std::span<mappedpng*> inputs, rowsource &rows, rowsink &&emit) {
+	std::vector<activemapping> ams;
+	ams.reserve(inputs.size());
+	int err = 0;
+	size_t next = 0;
+#ifndef NDEBUG
+	const size_t allocated = allocations();
+#endif
+	for(png_int_32 y = top; y < bottom && err == 0; y++) {
+		//Activate all mappins, keeping ams sorted by x and stable
+		for(; next < inputs.size() && inputs[next]->offset.y == y; next++) {
+			mappedpng &png = *inputs[next];
+			v2i32 brc = png.offset + v2i32{(png_int_32)png.x, (png_int_32)png.y};
+			activemapping am{&png, nullptr, brc, next};
+			err = rows.activate(next, am.pixels);
+			if(err != 0)
+				break;
+			//Within reserved capacity
+			ams.insert(std::upper_bound(ams.begin(), ams.end(), am), am);
+		}
+		if(err != 0)
+			break;
+		//Read rows
+		for(size_t i = 0; i < ams.size() && err == 0; i++) {
+			activemapping &am = ams[i];
+			err = rows.fetch(am.index, am.pixels);
+			size_t first, last;
+			if(err == 0 && rowbounds(am.pixels, am.png->x, first, last))
+				boxes[am.index].addrow(y - am.png->offset.y, first, last);
+		}
+		if(err == 0)
+			err = emit(y, std::span<const activemapping>(ams));
+		for(activemapping &am : ams)
+			rows.release(am.index);
+		rows.advance(y + 1);
+		//Deactivate useless in one compacting pass
+		std::erase_if(ams, [&](const activemapping &am) {
+			if(am.brc.y - 1 != y)
+				return false;
+			int ret = rows.deactivate(am.index, am.pixels);
+			if(err == 0)
+				err = ret;
+			return true;
+		});
+	}
+#ifndef NDEBUG
+	//Row buffers come from arena and pairs are planned, nothing may allocate per row on any thread
+	if(err == 0) {
+		if(allocations() != allocated)
+			diag.error("%zu heap allocations in row loop", allocations() - allocated);
+		assert(allocations() == allocated);
+	}
+#endif
+	for(activemapping &am : ams)
+		rows.deactivate(am.index, am.pixels);
+	return err;
+}
+
+//Write blended row of single output with its mask and previews
+static int emitrow(linkstate &ls, png_int_32 y, std::span<const activemapping> ams) {
+	blendrow(ls, y, ams);
+	if(ls.hist) {
+		for(const activemapping &am : ams)
+			ls.hist->input(am.index, am.pixels, am.png->x);
+		ls.hist->row(ls.out);
+	}
+	int err = writerow(&ls.output, ls.out);
+	if(err == 0)
+		err = ls.previews.push(ls.out);
+	if(err == 0 && ls.mask) {
+		err = writerow(ls.mask, ls.maskrow);
+		if(ls.maskdirty)
+			memset(ls.maskrow, 0, ls.mask->x);
+		ls.maskdirty = false;
+	}
+	return err;
+}
+
+template<class rowsource>
+static int linkrows(linkstate &ls, std::span<mappedpng*> inputs, rowsource &rows) {
+	ls.cluster.reserve(inputs.size());
+	return sweeprows(ls.diag, ls.boxes, ls.output.offset.y, ls.output.offset.y + ls.output.y, inputs, rows,
+		[&ls](png_int_32 y, std::span<const activemapping> ams) {
+			return emitrow(ls, y, ams);
+		});
+}
+
+//Counters for every pair of inputs with intersecting rectangles, inputs are sorted by y
+//Only inputs marked in member are paired when it is not empty
+static void planpairs(linkstate &ls, std::span<mappedpng*> inputs, std::span<const uint8_t> member = {}) {
+	for(size_t i = 0; i < inputs.size(); i++) {
+		const mappedpng &a = *inputs[i];
+		if(!member.empty() && !member[i])
+			continue;
+		for(size_t j = i + 1; j < inputs.size() && inputs[j]->offset.y < a.offset.y + (png_int_32)a.y; j++) {
+			const mappedpng &b = *inputs[j];
+			if(!member.empty() && !member[j])
+				continue;
+			if(a.offset.x < b.offset.x + (png_int_32)b.x && b.offset.x < a.offset.x + (png_int_32)a.x)
+				ls.conflicts.push_back({std::min(ls.priority[i], ls.priority[j]), std::max(ls.priority[i], ls.priority[j]), 0});
+		}
+	}
+	std::sort(ls.conflicts.begin(), ls.conflicts.end());
+}
+
+//Print per-pair conflict counts and hand them over to report
+static int reportconflicts(diagnostics &diag, std::span<const paircount> conflicts, std::span<const mappedio> inputs, tcc_link_report *report) {
+	std::vector<tcc_conflict> pairs;
+	uint64_t total = 0;
+	for(const paircount &c : conflicts) {
+		if(c.pixels == 0)
+			continue;
+		pairs.push_back({c.a, c.b, c.pixels});
+		total += c.pixels;
+	}
+	std::stable_sort(pairs.begin(), pairs.end(), [](const tcc_conflict &a, const tcc_conflict &b) {
+		return a.pixels > b.pixels;
+	});
+	for(const tcc_conflict &c : pairs)
+		diag.warn("%s and %s disagree on %" PRIu64 " pixels, %s wins", inputs[c.a].name, inputs[c.b].name, c.pixels, inputs[c.b].name);
+	if(!report)
+		return 0;
+	report->conflictpixels = total;
+	report->numconflicts = pairs.size();
+	report->conflicts = nullptr;
+	if(pairs.empty())
+		return 0;
+	report->conflicts = (tcc_conflict*)malloc(pairs.size() * sizeof(tcc_conflict));
+	if(!report->conflicts)
+		return -ENOMEM;
+	std::copy(pairs.begin(), pairs.end(), report->conflicts);
+	return 0;
+}
+
+//Report inputs with transparent borders, they waste decode time and sweep width
+static void reporttrim(diagnostics &diag, std::span<mappedio*> inputs, std::span<const bbox> boxes) {
+	size_t trimmable = 0;
+	uint64_t wasted = 0, total = 0;
+	for(size_t i = 0; i < inputs.size(); i++) {
+		const mappedpng &png = inputs[i]->png;
+		const bbox &box = boxes[i];
+		uint64_t area = (uint64_t)png.x * png.y, opaque = 0;
+		if(!box.empty())
+			opaque = (uint64_t)(box.right - box.left + 1) * (box.bottom - box.top + 1);
+		total += area;
+		if(opaque == area)
+			continue;
+		trimmable++;
+		wasted += area - opaque;
+		diag.info("Info: %s has transparent border, %" PRIu64 " of %" PRIu64 " pixels can be trimmed", inputs[i]->name, area - opaque, area);
+	}
+	if(trimmable)
+		diag.warn("%zu inputs have transparent borders (%" PRIu64 "%% of input pixels), recompile them with -trim", trimmable, wasted * 100 / total);
+}
+
+//Open inputs in order until first failure, they must be compiled templates with one palette
+static int openinputs(std::span<const tcc_source> sources, std::span<mappedio> inputs, std::vector<color_t> &wpalette, diagnostics &diag) {
+	for(size_t i = 0; i < sources.size(); i++) {
+		int err = opensource(sources[i], inputs[i], diag);
+		if(err != 0)
+			return err;
+		mappedpng &png = inputs[i].png;
+		if(png.colorType != PNG_COLOR_TYPE_PALETTE) {
+			diag.error("File %s is not a compiled template", inputs[i].name);
+			return -EINVAL;
+		}
+		if(png.paletted.numtransparent != 1 || png.paletted.alpha[0] != 0) {
+			diag.warn("File %s does not seems to be compiled template", inputs[i].name);
+		}
+		std::vector<color_t> palette(png.paletted.plt, png.paletted.plt + (size_t)png.paletted.numcolors);
+		if(wpalette.empty()) {
+			wpalette = std::move(palette);
+		} else if(wpalette != palette) {
+			diag.error("Palette mismatch, recompile all images");
+			return -EINVAL;
+		}
+	}
+	return 0;
+}
+
+static int linkinputs(const tcc_source *sources, size_t count, const tcc_link_options *opt, tcc_sink *sink, diagnostics &diag) {
+	if(count == 0) {
+		diag.error("Nothing to link");
+		return -EINVAL;
+	}
+
+	//Mappings keep pointers to their streams, so they must not move
+	std::vector<mappedio> inputs(count);
+	std::vector<mappedio*> order;
+	std::vector<color_t> wpalette;
+	int err = openinputs(std::span<const tcc_source>(sources, count), inputs, wpalette, diag);
+	v2i32 min(INT32_MAX, INT32_MAX), max(INT32_MIN, INT32_MIN);
+	for(mappedio &io : inputs) {
+		if(!io.png.ptr)
+			break;
+		order.push_back(&io);
+		min = minel(min, io.png.offset);
+		max = maxel(max, io.png.offset + v2i32{(png_int_32)io.png.x, (png_int_32)io.png.y});
+	}
+	std::stable_sort(order.begin(), order.end(), [](const mappedio *a, const mappedio *b) {
+		return a->png.offset.y < b->png.offset.y;
+	});
+	std::vector<mappedpng*> sweep;
+	for(mappedio *io : order)
+		sweep.push_back(&io->png);
+	std::vector<bbox> boxes(count);
+	std::vector<size_t> priority;
+	for(mappedio *io : order)
+		priority.push_back(io - inputs.data());
+
+	//Open write mapping
+	mappedio outio = {}, maskio = {};
+	mappedpng &output = outio.png;
+	uint8_t zero = 0;
+	color_t maskplt[2] = {{0, 0, 0}, {255, 0, 0}};
+	pyramid previews;
+	std::span<tcc_sink> previewsinks(opt->previews, opt->previews ? opt->numpreviews : 0);
+	linkstate ls{diag, output, nullptr, priority, boxes, nullptr, nullptr, false, previews, nullptr, {}, {}};
+	bool outopen = false;
+	if(err == 0) {
+		output.x = max.x - min.x;
+		output.y = max.y - min.y;
+		output.colorType = PNG_COLOR_TYPE_PALETTE;
+		output.bitDepth = 8;
+		output.offset.x = min.x;
+		output.offset.y = min.y;
+		output.write = true;
+		output.paletted.alpha = &zero;
+		output.paletted.numtransparent = 1;
+		output.paletted.plt = wpalette.data();
+		output.paletted.numcolors = wpalette.size();
+		err = opensink(*sink, outio, diag);
+		outopen = err == 0;
+	}
+	if(err == 0 && opt->conflictmask) {
+		//Same geometry, conflicting pixels are red
+		maskio.png = output;
+		maskio.png.paletted.plt = maskplt;
+		maskio.png.paletted.numcolors = 2;
+		err = opensink(*opt->conflictmask, maskio, diag);
+		if(err == 0) {
+			ls.mask = &maskio.png;
+		}
+	}
+	if(err == 0)
+		err = previews.open(previewsinks, output, diag);
+	histogram hist;
+	if(err == 0 && opt->histogram) {
+		err = hist.init(output, opt->histogramtile, sweep.size(), diag);
+		ls.hist = &hist;
+	}
+
+	//Lay out all row buffers, output and mask rows live through the whole sweep
+	unsigned depth = opt->threads ? (opt->depth ? opt->depth : 8) : 1;
+	rowarena arena;
+	std::vector<png_bytep> slots;
+	if(err == 0) {
+		std::vector<rowarena::request> requests;
+		for(const mappedpng *png : sweep)
+			requests.push_back({(size_t)png->x * depth, (int64_t)png->offset.y - (opt->threads ? depth : 0), (int64_t)png->offset.y + png->y});
+		requests.push_back({output.x, INT64_MIN, INT64_MAX});
+		if(ls.mask)
+			requests.push_back({output.x, INT64_MIN, INT64_MAX});
+		err = arena.plan(requests);
+		if(err != 0)
+			diag.error("Out of memory");
+		else {
+			for(size_t i = 0; i < sweep.size(); i++)
+				slots.push_back(arena.slot(i));
+			ls.out = arena.slot(sweep.size());
+			if(ls.mask) {
+				ls.maskrow = arena.slot(sweep.size() + 1);
+				memset(ls.maskrow, 0, output.x);
+			}
+			planpairs(ls, sweep);
+			diag.info("Info: %zu bytes of row buffers for %zu inputs", arena.size(), sweep.size());
+		}
+	}
+	if(err == 0) {
+		if(opt->threads == 0) {
+			directrows rows(sweep, slots);
+			err = linkrows(ls, sweep, rows);
+		} else {
+			rowpipeline rows(sweep, slots, opt->threads, depth);
+			err = rows.start(output.offset.y);
+			if(err != 0)
+				diag.error("Failed to start decoder threads");
+			else
+				err = linkrows(ls, sweep, rows);
+			int ret = rows.finish();
+			if(err == 0)
+				err = ret;
+		}
+	}
+	err = previews.close(previewsinks, err);
+	if(ls.mask)
+		err = closesink(*opt->conflictmask, maskio, err);
+	if(outopen)
+		err = closesink(*sink, outio, err);
+
+	//Release inputs left mapped after failure
+	for(mappedpng *png : sweep)
+		if(png->ptr)
+			unmap(png);
+	if(err == 0 && ls.hist)
+		err = hist.write(*opt->histogram, order, diag);
+	if(err == 0)
+		err = reportconflicts(diag, ls.conflicts, inputs, opt->report);
+	if(err == 0)
+		reporttrim(diag, order, boxes);
+	diag.summary(outio.name ? outio.name : "link");
+	return err;
+}
+
+int tcc_link(const tcc_source *sources, size_t count, const tcc_link_options *opt, tcc_sink *sink) {
+	const tcc_link_options defaults = {};
+	if(!opt)
+		opt = &defaults;
+	diagnostics diag(opt->log);
+	return guarded(diag, [&]() {
+		return linkinputs(sources, count, opt, sink, diag);
+	});
+}
+
+//Output of tcc_link_targets() composed from its members over bounding box of them
+struct linktarget {
+	mappedpng canvas = {};//Geometry of composed row
+	mappedio io = {};//Clipped output
+	linkstate ls;
+	std::vector<uint8_t> member;//By sweep index
+	std::vector<activemapping> ams;//Active members of current row
+	size_t skip = 0;//Offset of output in composed row
+	tcc_sink *sink = nullptr;
+	bool open = false;
+	int err = 0;
+
+	linktarget(diagnostics &diag, pyramid &previews, std::span<const size_t> priority, std::span<bbox> boxes):
+		ls{diag, canvas, nullptr, priority, boxes, nullptr, nullptr, false, previews, nullptr, {}, {}} {}
+};
+
+static int emittarget(linktarget &t, png_int_32 y, std::span<const activemapping> ams) {
+	const mappedpng &output = t.io.png;
+	if(y < output.offset.y || y >= output.offset.y + (png_int_32)output.y)
+		return 0;
+	//Within reserved capacity
+	t.ams.clear();
+	for(const activemapping &am : ams)
+		if(t.member[am.index])
+			t.ams.push_back(am);
+	blendrow(t.ls, y, t.ams);
+	return writerow(&t.io.png, t.ls.out + t.skip);
+}
+
+//Members of target by command line index, false when target is invalid
+static bool targetmembers(const tcc_link_target &target, std::span<const mappedio> inputs, std::vector<uint8_t> &member) {
+	member.assign(inputs.size(), !target.inputs);
+	if(target.inputs)
+		for(size_t i = 0; i < target.numinputs; i++) {
+			if(target.inputs[i] >= inputs.size())
+				return false;
+			member[target.inputs[i]] = 1;
+		}
+	if(target.clipwidth && target.clipheight) {
+		int64_t left = target.clipx, top = target.clipy, right = left + target.clipwidth, bottom = top + target.clipheight;
+		for(size_t i = 0; i < inputs.size(); i++) {
+			const mappedpng &png = inputs[i].png;
+			if((int64_t)png.offset.x >= right || (int64_t)png.offset.x + png.x <= left
+					|| (int64_t)png.offset.y >= bottom || (int64_t)png.offset.y + png.y <= top)
+				member[i] = 0;
+		}
+	}
+	return std::find(member.begin(), member.end(), 1) != member.end();
+}
+
+static int linktargets(const tcc_source *sources, size_t count, const tcc_link_target *targets, size_t numtargets, const tcc_link_options *opt, diagnostics &diag) {
+	if(count == 0 || numtargets == 0) {
+		diag.error("Nothing to link");
+		return -EINVAL;
+	}
+	if(opt->conflictmask || (opt->previews && opt->numpreviews) || opt->histogram) {
+		diag.error("Conflict mask, previews and histogram need single output");
+		return -EINVAL;
+	}
+
+	std::vector<mappedio> inputs(count);
+	std::vector<color_t> wpalette;
+	int err = openinputs(std::span<const tcc_source>(sources, count), inputs, wpalette, diag);
+
+	//Only inputs used by some target are decoded
+	std::vector<std::vector<uint8_t>> members(numtargets);
+	std::vector<uint8_t> used(count, 0);
+	for(size_t t = 0; t < numtargets && err == 0; t++) {
+		if(!targetmembers(targets[t], inputs, members[t])) {
+			diag.error("Output %zu has no inputs", t);
+			err = -EINVAL;
+		}
+		for(size_t i = 0; i < count; i++)
+			used[i] |= members[t][i];
+	}
+	std::vector<mappedio*> order;
+	for(size_t i = 0; i < count; i++) {
+		if(err == 0 && used[i])
+			order.push_back(&inputs[i]);
+		else if(inputs[i].png.ptr)
+			unmap(&inputs[i].png);
+	}
+	std::stable_sort(order.begin(), order.end(), [](const mappedio *a, const mappedio *b) {
+		return a->png.offset.y < b->png.offset.y;
+	});
+	std::vector<mappedpng*> sweep;
+	std::vector<size_t> priority;
+	for(mappedio *io : order) {
+		sweep.push_back(&io->png);
+		priority.push_back(io - inputs.data());
+	}
+	std::vector<bbox> boxes(sweep.size());
+
+	//Conflicting pixels of all targets go to one summary, pixels shared by targets count once per target
+	pyramid nopreviews;
+	uint8_t zero = 0;
+	std::vector<std::unique_ptr<linktarget>> tgs;
+	png_int_32 top = INT32_MAX, bottom = INT32_MIN;
+	for(size_t t = 0; t < numtargets && err == 0; t++) {
+		tgs.push_back(std::make_unique<linktarget>(diag, nopreviews, priority, boxes));
+		linktarget &tg = *tgs.back();
+		tg.member.resize(sweep.size());
+		v2i32 min(INT32_MAX, INT32_MAX), max(INT32_MIN, INT32_MIN);
+		for(size_t i = 0; i < sweep.size(); i++) {
+			tg.member[i] = members[t][priority[i]];
+			if(!tg.member[i])
+				continue;
+			min = minel(min, sweep[i]->offset);
+			max = maxel(max, sweep[i]->offset + v2i32{(png_int_32)sweep[i]->x, (png_int_32)sweep[i]->y});
+		}
+		tg.canvas.offset = min;
+		tg.canvas.x = max.x - min.x;
+		tg.canvas.y = max.y - min.y;
+		if(targets[t].clipwidth && targets[t].clipheight) {
+			min = maxel(min, v2i32{targets[t].clipx, targets[t].clipy});
+			max.x = std::min<int64_t>(max.x, (int64_t)targets[t].clipx + targets[t].clipwidth);
+			max.y = std::min<int64_t>(max.y, (int64_t)targets[t].clipy + targets[t].clipheight);
+		}
+		mappedpng &output = tg.io.png;
+		output.x = max.x - min.x;
+		output.y = max.y - min.y;
+		output.colorType = PNG_COLOR_TYPE_PALETTE;
+		output.bitDepth = 8;
+		output.offset = min;
+		output.write = true;
+		output.paletted.alpha = &zero;
+		output.paletted.numtransparent = 1;
+		output.paletted.plt = wpalette.data();
+		output.paletted.numcolors = wpalette.size();
+		tg.skip = min.x - tg.canvas.offset.x;
+		tg.sink = targets[t].output;
+		tg.ams.reserve(sweep.size());
+		tg.ls.cluster.reserve(sweep.size());
+		planpairs(tg.ls, sweep, tg.member);
+		top = std::min(top, tg.canvas.offset.y);
+		bottom = std::max(bottom, max.y);
+		err = opensink(*tg.sink, tg.io, diag);
+		tg.open = err == 0;
+	}
+
+	//Input rings as in tcc_link, composed row of every target lives through the whole sweep
+	unsigned depth = opt->threads ? (opt->depth ? opt->depth : 8) : 1;
+	rowarena arena;
+	std::vector<png_bytep> slots;
+	if(err == 0) {
+		std::vector<rowarena::request> requests;
+		for(const mappedpng *png : sweep)
+			requests.push_back({(size_t)png->x * depth, (int64_t)png->offset.y - (opt->threads ? depth : 0), (int64_t)png->offset.y + png->y});
+		for(const std::unique_ptr<linktarget> &tg : tgs)
+			requests.push_back({tg->canvas.x, INT64_MIN, INT64_MAX});
+		err = arena.plan(requests);
+		if(err != 0)
+			diag.error("Out of memory");
+		else {
+			for(size_t i = 0; i < sweep.size(); i++)
+				slots.push_back(arena.slot(i));
+			for(size_t t = 0; t < tgs.size(); t++)
+				tgs[t]->ls.out = arena.slot(sweep.size() + t);
+			diag.info("Info: %zu bytes of row buffers for %zu inputs and %zu outputs", arena.size(), sweep.size(), tgs.size());
+		}
+	}
+
+	//Targets are composed and encoded in parallel, each row is handed out behind a barrier
+	if(err == 0) {
+		unsigned writers = std::min<size_t>(tgs.size(), std::max(1u, std::thread::hardware_concurrency()));
+		std::barrier<> sync(writers);
+		std::atomic<size_t> next{0};
+		std::atomic<bool> stop{false};
+		png_int_32 rowy = 0;
+		std::span<const activemapping> rowams;
+		auto work = [&]() {
+			for(size_t t; (t = next.fetch_add(1, std::memory_order_relaxed)) < tgs.size();)
+				if(tgs[t]->err == 0)
+					tgs[t]->err = emittarget(*tgs[t], rowy, rowams);
+		};
+		std::vector<std::thread> threads;
+		try {
+			for(unsigned i = 1; i < writers; i++)
+				threads.emplace_back([&]() {
+					for(;;) {
+						sync.arrive_and_wait();
+						if(stop.load(std::memory_order_relaxed))
+							return;
+						work();
+						sync.arrive_and_wait();
+					}
+				});
+		} catch(...) {
+			//Fewer writers are fine, calling thread writes too
+		}
+		for(size_t i = threads.size() + 1; i < writers; i++)
+			sync.arrive_and_drop();
+		auto emit = [&](png_int_32 y, std::span<const activemapping> ams) {
+			rowy = y;
+			rowams = ams;
+			next.store(0, std::memory_order_relaxed);
+			sync.arrive_and_wait();
+			work();
+			sync.arrive_and_wait();
+			for(const std::unique_ptr<linktarget> &tg : tgs)
+				if(tg->err != 0)
+					return tg->err;
+			return 0;
+		};
+		if(opt->threads == 0) {
+			directrows rows(sweep, slots);
+			err = sweeprows(diag, boxes, top, bottom, sweep, rows, emit);
+		} else {
+			rowpipeline rows(sweep, slots, opt->threads, depth);
+			err = rows.start(top);
+			if(err != 0)
+				diag.error("Failed to start decoder threads");
+			else
+				err = sweeprows(diag, boxes, top, bottom, sweep, rows, emit);
+			int ret = rows.finish();
+			if(err == 0)
+				err = ret;
+		}
+		stop.store(true, std::memory_order_relaxed);
+		sync.arrive_and_wait();
+		for(std::thread &thread : threads)
+			thread.join();
+	}
+	for(std::unique_ptr<linktarget> &tg : tgs)
+		if(tg->open)
+			err = closesink(*tg->sink, tg->io, err);
+	for(mappedpng *png : sweep)
+		if(png->ptr)
+			unmap(png);
+
+	//Same pair may be clipped differently in every target, report largest count
+	std::vector<paircount> conflicts;
+	for(std::unique_ptr<linktarget> &tg : tgs)
+		conflicts.insert(conflicts.end(), tg->ls.conflicts.begin(), tg->ls.conflicts.end());
+	std::sort(conflicts.begin(), conflicts.end(), [](const paircount &a, const paircount &b) {
+		return a < b || (!(b < a) && a.pixels > b.pixels);
+	});
+	conflicts.erase(std::unique(conflicts.begin(), conflicts.end(), [](const paircount &a, const paircount &b) {
+		return !(a < b) && !(b < a);
+	}), conflicts.end());
+	if(err == 0)
+		err = reportconflicts(diag, conflicts, inputs, opt->report);
+	if(err == 0) {
+		//Inputs cut by clipped bottom were not fully decoded, their boxes are incomplete
+		std::vector<mappedio*> decoded;
+		std::vector<bbox> decodedboxes;
+		for(size_t i = 0; i < order.size(); i++)
+			if((int64_t)order[i]->png.offset.y + order[i]->png.y <= bottom) {
+				decoded.push_back(order[i]);
+				decodedboxes.push_back(boxes[i]);
+			}
+		reporttrim(diag, decoded, decodedboxes);
+	}
+	diag.summary("link");
+	return err;
+}
+
+int tcc_link_targets(const tcc_source *sources, size_t count, const tcc_link_target *targets, size_t numtargets, const tcc_link_options *opt) {
+	const tcc_link_options defaults = {};
+	if(!opt)
+		opt = &defaults;
+	diagnostics diag(opt->log);
+	return guarded(diag, [&]() {
+		return linktargets(sources, count, targets, numtargets, opt, diag);
+	});
+}
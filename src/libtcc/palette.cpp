@@ -0,0 +1,162 @@
+#include "internal.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <new>
+
+int plt2pltTable(diagnostics &diag, std::span<const color_t> input, std::span<const uint8_t> inputAlpha, std::vector<color_t> &outputPlt, bool allowGrowth, std::vector<uint8_t> &pltpair) {
+	size_t len = input.size(), alen = inputAlpha.size();
+	bool alphaerr = false;
+	pltpair.clear();
+	for(size_t i = 0; i < len; i++) {
+		if(i < alen && inputAlpha[i] != 255) {
+			if(inputAlpha[i] != 0 && !alphaerr) {
+				diag.warn("Paletted image uses color with alpha neither 255 nor 0, marking as transparent");
+				alphaerr = true;
+			}
+			pltpair.push_back(0);
+		} else {
+			color_t color = input[i];
+			size_t index, outlen = outputPlt.size();
+			for(index = 0; index < outlen && outputPlt[index] != color; index++);
+			if(index == outlen) {
+				if(!allowGrowth) {
+					diag.error("Image wants color that does not exist in palette");
+					return -EINVAL;
+				}
+				if(index == 255) {
+					diag.error("Palette merge results in too big palette");
+					//Oh shit
+					return -ERANGE;
+				}
+				outputPlt.push_back(color);
+			}
+			pltpair.push_back(index + 1);
+		}
+	}
+	//Out-of-range indices are transparent
+	pltpair.resize(256, 0);
+
+	return 0;
+}
+
+void tcc_palette::rebuild() {
+	table.fill(0);
+	for(size_t i = 0; i < colors.size(); i++) {
+		uint32_t rgb = packrgb(colors[i]);
+		uint32_t h = (rgb * 2654435761u) >> 23;
+		while(table[h] != 0 && table[h] >> 8 != rgb)
+			h = (h + 1) & 511;
+		if(table[h] == 0)
+			table[h] = rgb << 8 | (uint32_t)(i + 1);
+	}
+}
+
+static int readPalette(diagnostics &diag, mappedio &io, std::vector<color_t> &plt) {
+	mappedpng &png = io.png;
+	if(png.colorType != PNG_COLOR_TYPE_RGB && png.colorType != PNG_COLOR_TYPE_RGBA) {
+		diag.error("Cant read palette from image type %d", png.colorType);
+		return -EINVAL;
+	}
+	//Read PNG
+	if(png.x > 255 || png.x * png.y > 255) {
+		diag.error("Palette image is too big");
+		return -ERANGE;
+	}
+	png_bytep data;
+	int err = readPNG(png, data);
+	if(err != 0)
+		return err;
+	//Clear just in case
+	plt.clear();
+
+	if(png.colorType == PNG_COLOR_TYPE_RGB) {
+		//Start reading
+		size_t offset = 0, size = png.x * png.y * 3;
+		for(; offset < size; offset += 3) {
+			const color_t color{data[offset], data[offset + 1], data[offset + 2]};
+			//Add only unique
+			if(std::find(plt.begin(), plt.end(), color) == plt.end())
+				plt.push_back(color);
+		}
+	} else if(png.colorType == PNG_COLOR_TYPE_RGBA) {
+		size_t offset = 0, size = png.x * png.y * 4;
+		for(; offset < size; offset += 4) {
+			const color_t color{data[offset], data[offset + 1], data[offset + 2]};
+			const uint8_t alpha = data[offset + 3];
+			//Skip transparent
+			if(alpha == 0)
+				continue;
+			else if(alpha != 255) {
+				diag.report(DIAG_SEMITRANSPARENT, (offset / 4) % png.x, (offset / 4) / png.x);
+				continue;
+			}
+			//Add only unique
+			if(std::find(plt.begin(), plt.end(), color) == plt.end())
+				plt.push_back(color);
+		}
+	}
+
+	free(data);
+	diag.summary(io.name);
+	return 0;
+}
+
+static int loadpalette(const tcc_source *src, tcc_palette **plt, diagnostics &diag) {
+	mappedio io;
+	int err = opensource(*src, io, diag);
+	if(err != 0)
+		return err;
+	tcc_palette *palette = new(std::nothrow) tcc_palette;
+	if(!palette)
+		err = -ENOMEM;
+	else
+		err = readPalette(diag, io, palette->colors);
+	int ret = unmap(&io.png);
+	if(err == 0)
+		err = ret;
+	if(err != 0) {
+		delete palette;
+		return err;
+	}
+	palette->rebuild();
+	*plt = palette;
+	return 0;
+}
+
+int tcc_palette_load(const tcc_source *src, const tcc_logger *log, tcc_palette **plt) {
+	diagnostics diag(log);
+	return guarded(diag, [&]() {
+		return loadpalette(src, plt, diag);
+	});
+}
+
+int tcc_palette_create(const uint8_t *rgb, size_t count, tcc_palette **plt) {
+	if(count > 255)
+		return -ERANGE;
+	tcc_palette *palette = new(std::nothrow) tcc_palette;
+	if(!palette)
+		return -ENOMEM;
+	try {
+		for(size_t i = 0; i < count; i++) {
+			const color_t color{rgb[i * 3], rgb[i * 3 + 1], rgb[i * 3 + 2]};
+			if(std::find(palette->colors.begin(), palette->colors.end(), color) == palette->colors.end())
+				palette->colors.push_back(color);
+		}
+	} catch(const std::bad_alloc&) {
+		delete palette;
+		return -ENOMEM;
+	}
+	palette->rebuild();
+	*plt = palette;
+	return 0;
+}
+
+size_t tcc_palette_size(const tcc_palette *plt) {
+	return plt->colors.size();
+}
+
+void tcc_palette_free(tcc_palette *plt) {
+	delete plt;
+}
@@ -0,0 +1,337 @@
+#include "chunks.hpp"
+#include "rowops.hpp"
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdlib>
+#include <exception>
+#include <zlib.h>
+
+//Delta between two versions of a template
+//NEW row is compared against OLD pixels at the same canvas position, transparent
+//where OLD has none, and differing spans are stored as varints and new indices in a deflated body
+
+static const uint8_t patchmagic[8] = {'T', 'C', 'C', 'P', 'A', 'T', '1', 0};
+//Maximum compression ratio of deflate
+static constexpr uint64_t DEFLATEMAXRATIO = 1032;
+//Gaps shorter than span header are cheaper to store inside span
+static constexpr size_t MERGEGAP = 4;
+
+struct patchheader {
+	v2i32 oldoffset, newoffset;
+	png_uint_32 oldx, oldy, newx, newy;
+	std::vector<color_t> plt;
+	std::vector<uint8_t> trns;
+	uint32_t oldcrc, newcrc;//Of OLD rows under NEW and of NEW rows
+	uint32_t filecrc;//Of NEW file as written by tcc
+	uint64_t filesize, spans, pixels, rawsize;
+};
+
+static void putvar(std::vector<uint8_t> &out, uint64_t v) {
+	for(; v >= 0x80; v >>= 7)
+		out.push_back(v | 0x80);
+	out.push_back(v);
+}
+
+static bool getvar(const uint8_t *&p, const uint8_t *end, uint64_t &v) {
+	v = 0;
+	for(unsigned shift = 0; p < end && shift < 64; shift += 7) {
+		uint8_t b = *p++;
+		v |= (uint64_t)(b & 0x7F) << shift;
+		if(!(b & 0x80))
+			return true;
+	}
+	return false;
+}
+
+//OLD pixels under NEW row y, OLD rows are read in order and hashed
+static int baserow(mappedpng &old, png_bytep oldrow, uint32_t &crc, const mappedpng &dst, png_int_32 y, png_bytep base) {
+	memset(base, 0, dst.x);
+	int64_t oy = (int64_t)y - old.offset.y;
+	if(oy < 0 || oy >= old.y)
+		return 0;
+	while(old.row <= oy) {
+		int err = readrow(&old, oldrow);
+		if(err != 0)
+			return err;
+		crc = crc32(crc, oldrow, old.x);
+	}
+	int64_t left = std::max<int64_t>(dst.offset.x, old.offset.x);
+	int64_t right = std::min<int64_t>((int64_t)dst.offset.x + dst.x, (int64_t)old.offset.x + old.x);
+	if(left < right)
+		memcpy(base + (left - dst.offset.x), oldrow + (left - old.offset.x), right - left);
+	return 0;
+}
+
+static int readall(const tcc_source &src, std::vector<uint8_t> &data, diagnostics &diag) {
+	bytesource in;
+	int err = in.open(src, diag);
+	if(err == 0)
+		err = in.readall(data);
+	return err;
+}
+
+static int makepatch(const tcc_source *oldsrc, const tcc_source *newsrc, tcc_sink *sink, diagnostics &diag) {
+	std::vector<uint8_t> newfile;
+	int err = readall(*newsrc, newfile, diag);
+	if(err != 0)
+		return err;
+	mappedio oldio, newio;
+	err = opensource(*oldsrc, oldio, diag);
+	if(err != 0)
+		return err;
+	//NEW is read once, so standard input works too
+	const tcc_source newmem{nullptr, newfile.data(), newfile.size()};
+	err = opensource(newmem, newio, diag);
+	if(err != 0) {
+		unmap(&oldio.png);
+		return err;
+	}
+	if(newsrc->path)
+		newio.name = newsrc->path;
+	mappedpng &old = oldio.png, &cur = newio.png;
+	if(old.colorType != PNG_COLOR_TYPE_PALETTE || cur.colorType != PNG_COLOR_TYPE_PALETTE) {
+		diag.error("Both %s and %s must be compiled templates", oldio.name, newio.name);
+		unmap(&old);
+		unmap(&cur);
+		return -EINVAL;
+	}
+
+	patchheader hdr = {old.offset, cur.offset, old.x, old.y, cur.x, cur.y,
+		std::vector<color_t>(cur.paletted.plt, cur.paletted.plt + cur.paletted.numcolors),
+		std::vector<uint8_t>(cur.paletted.alpha, cur.paletted.alpha + cur.paletted.numtransparent),
+		0, 0, (uint32_t)crc32(0, newfile.data(), newfile.size()), newfile.size(), 0, 0, 0};
+	std::vector<uint8_t> oldrow(old.x), base(cur.x), row(cur.x), body;
+	png_int_32 lasty = cur.offset.y;
+	for(png_uint_32 i = 0; i < cur.y && err == 0; i++) {
+		png_int_32 y = cur.offset.y + i;
+		err = readrow(&cur, row.data());
+		if(err == 0)
+			err = baserow(old, oldrow.data(), hdr.oldcrc, cur, y, base.data());
+		if(err != 0)
+			break;
+		hdr.newcrc = crc32(hdr.newcrc, row.data(), cur.x);
+		size_t x = 0;
+		for(size_t start; (start = x + firstdiff(row.data() + x, base.data() + x, cur.x - x)) < cur.x;) {
+			//Extend over differing bytes and short equal gaps
+			size_t end = start + 1;
+			for(;;) {
+				for(; end < cur.x && row[end] != base[end]; end++);
+				size_t gap = std::min<size_t>(MERGEGAP, cur.x - end);
+				size_t next = firstdiff(row.data() + end, base.data() + end, gap);
+				if(next == gap)
+					break;
+				end += next;
+			}
+			putvar(body, y - lasty);
+			putvar(body, start - x);
+			putvar(body, end - start);
+			body.insert(body.end(), row.begin() + start, row.begin() + end);
+			for(size_t j = start; j < end; j++)
+				hdr.pixels += row[j] != base[j];
+			hdr.spans++;
+			lasty = y;
+			x = end;
+		}
+	}
+	unmap(&old);
+	int ret = unmap(&cur);
+	if(err == 0)
+		err = ret;
+	if(err != 0)
+		return err;
+
+	hdr.rawsize = body.size();
+	uLongf packedsize = compressBound(body.size());
+	std::vector<uint8_t> packed(packedsize);
+	if(compress2(packed.data(), &packedsize, body.data(), body.size(), Z_BEST_COMPRESSION) != Z_OK)
+		return -ENOMEM;
+	std::vector<uint8_t> out(patchmagic, patchmagic + sizeof(patchmagic));
+	for(int32_t v : {hdr.oldoffset.x, hdr.oldoffset.y, hdr.newoffset.x, hdr.newoffset.y})
+		putle(out, (uint32_t)v, 4);
+	for(uint32_t v : {hdr.oldx, hdr.oldy, hdr.newx, hdr.newy})
+		putle(out, v, 4);
+	putle(out, hdr.plt.size(), 2);
+	for(const color_t &c : hdr.plt) {
+		out.push_back(c.red);
+		out.push_back(c.green);
+		out.push_back(c.blue);
+	}
+	putle(out, hdr.trns.size(), 2);
+	out.insert(out.end(), hdr.trns.begin(), hdr.trns.end());
+	for(uint32_t v : {hdr.oldcrc, hdr.newcrc, hdr.filecrc})
+		putle(out, v, 4);
+	for(uint64_t v : {hdr.filesize, hdr.spans, hdr.pixels, hdr.rawsize, (uint64_t)packedsize})
+		putle(out, v, 8);
+	out.insert(out.end(), packed.begin(), packed.begin() + packedsize);
+	err = writeblob(*sink, out.data(), out.size(), diag);
+	if(err == 0)
+		diag.info("Info: %" PRIu64 " changed pixels in %" PRIu64 " spans, patch is %zu bytes", hdr.pixels, hdr.spans, out.size());
+	return err;
+}
+
+int tcc_patch(const tcc_source *oldsrc, const tcc_source *newsrc, const tcc_logger *log, tcc_sink *sink) {
+	diagnostics diag(log);
+	return guarded(diag, [&]() {
+		return makepatch(oldsrc, newsrc, sink, diag);
+	});
+}
+
+static int parsepatch(std::span<const uint8_t> data, patchheader &hdr, std::vector<uint8_t> &body) {
+	const uint8_t *p = data.data(), *end = p + data.size();
+	if(data.size() < 8 + 32 + 2 || memcmp(p, patchmagic, sizeof(patchmagic)) != 0)
+		return -EINVAL;
+	p += sizeof(patchmagic);
+	hdr.oldoffset.x = (int32_t)getle(p, 4);
+	hdr.oldoffset.y = (int32_t)getle(p, 4);
+	hdr.newoffset.x = (int32_t)getle(p, 4);
+	hdr.newoffset.y = (int32_t)getle(p, 4);
+	hdr.oldx = getle(p, 4);
+	hdr.oldy = getle(p, 4);
+	hdr.newx = getle(p, 4);
+	hdr.newy = getle(p, 4);
+	size_t n = getle(p, 2);
+	if(n > 256 || (size_t)(end - p) < n * 3 + 2)
+		return -EINVAL;
+	hdr.plt.resize(n);
+	for(color_t &c : hdr.plt) {
+		c = {p[0], p[1], p[2]};
+		p += 3;
+	}
+	n = getle(p, 2);
+	if(n > 256 || (size_t)(end - p) < n + 12 + 40)
+		return -EINVAL;
+	hdr.trns.assign(p, p + n);
+	p += n;
+	hdr.oldcrc = getle(p, 4);
+	hdr.newcrc = getle(p, 4);
+	hdr.filecrc = getle(p, 4);
+	hdr.filesize = getle(p, 8);
+	hdr.spans = getle(p, 8);
+	hdr.pixels = getle(p, 8);
+	hdr.rawsize = getle(p, 8);
+	uint64_t packedsize = getle(p, 8);
+	if((uint64_t)(end - p) != packedsize || hdr.newx == 0 || hdr.newy == 0 || hdr.newx > INT32_MAX || hdr.newy > INT32_MAX)
+		return -EINVAL;
+	//Body size is untrusted, deflate cannot expand beyond its ratio
+	if(hdr.rawsize > packedsize * DEFLATEMAXRATIO + 64)
+		return -EINVAL;
+	body.resize(hdr.rawsize);
+	uLongf size = hdr.rawsize;
+	if(uncompress(body.data(), &size, p, packedsize) != Z_OK || size != hdr.rawsize)
+		return -EINVAL;
+	return 0;
+}
+
+static int applypatch(const tcc_source *oldsrc, const tcc_source *patch, tcc_sink *sink, diagnostics &diag) {
+	std::vector<uint8_t> data, body;
+	patchheader hdr;
+	int err = readall(*patch, data, diag);
+	if(err != 0)
+		return err;
+	try {
+		err = parsepatch(data, hdr, body);
+	} catch(const std::bad_alloc&) {
+		err = -ENOMEM;
+	} catch(const std::exception&) {
+		err = -EINVAL;
+	}
+	if(err != 0) {
+		diag.error("%s is not a valid patch", patch->path ? patch->path : "memory buffer");
+		return err;
+	}
+	mappedio oldio;
+	err = opensource(*oldsrc, oldio, diag);
+	if(err != 0)
+		return err;
+	mappedpng &old = oldio.png;
+	if(old.colorType != PNG_COLOR_TYPE_PALETTE || !(old.offset.x == hdr.oldoffset.x && old.offset.y == hdr.oldoffset.y)
+			|| old.x != hdr.oldx || old.y != hdr.oldy) {
+		diag.error("Patch does not apply to %s, it was made for another version", oldio.name);
+		unmap(&old);
+		return -EINVAL;
+	}
+
+	//Encode to memory first to compare with NEW file
+	tcc_sink mem{nullptr, nullptr, 0};
+	mappedio out;
+	mappedpng &output = out.png;
+	output.x = hdr.newx;
+	output.y = hdr.newy;
+	output.colorType = PNG_COLOR_TYPE_PALETTE;
+	output.bitDepth = 8;
+	output.offset = hdr.newoffset;
+	output.write = true;
+	output.paletted.plt = hdr.plt.data();
+	output.paletted.numcolors = hdr.plt.size();
+	output.paletted.alpha = hdr.trns.data();
+	output.paletted.numtransparent = hdr.trns.size();
+	err = opensink(mem, out, diag);
+	if(err != 0) {
+		unmap(&old);
+		return err;
+	}
+	std::vector<uint8_t> oldrow(old.x), row(output.x);
+	uint32_t oldcrc = 0, newcrc = 0;
+	const uint8_t *p = body.data(), *end = p + body.size();
+	//Spans start relative to end of previous span in the same row
+	uint64_t spans = 0, dy, dx, len;
+	int64_t spany = output.offset.y;
+	bool pending = false;
+	for(png_uint_32 i = 0; i < output.y && err == 0; i++) {
+		png_int_32 y = output.offset.y + i;
+		err = baserow(old, oldrow.data(), oldcrc, output, y, row.data());
+		size_t x = 0;
+		while(err == 0) {
+			if(!pending) {
+				if(spans == hdr.spans)
+					break;
+				if(!getvar(p, end, dy) || !getvar(p, end, dx) || !getvar(p, end, len) || dy > UINT32_MAX) {
+					err = -EINVAL;
+					break;
+				}
+				spany += dy;
+				spans++;
+				pending = true;
+			}
+			if(spany != y)
+				break;
+			if(dx > output.x - x || len > output.x - x - dx || (uint64_t)(end - p) < len) {
+				err = -EINVAL;
+				break;
+			}
+			memcpy(row.data() + x + dx, p, len);
+			p += len;
+			x += dx + len;
+			pending = false;
+		}
+		if(err != 0)
+			break;
+		newcrc = crc32(newcrc, row.data(), output.x);
+		err = writerow(&output, row.data());
+	}
+	if(err == 0 && (pending || p != end))
+		err = -EINVAL;
+	if(err == -EINVAL)
+		diag.error("Patch is corrupt");
+	err = closesink(mem, out, err);
+	unmap(&old);
+	if(err == 0 && (oldcrc != hdr.oldcrc || newcrc != hdr.newcrc)) {
+		diag.error("Patch does not apply to %s, it was made for another version", oldio.name);
+		err = -EINVAL;
+	}
+	if(err == 0) {
+		if(mem.size != hdr.filesize || crc32(0, (const Bytef*)mem.data, mem.size) != hdr.filecrc)
+			diag.warn("Pixels match, but NEW was encoded differently, output is not byte-identical to it");
+		err = writeblob(*sink, mem.data, mem.size, diag);
+	}
+	free(mem.data);
+	return err;
+}
+
+int tcc_apply(const tcc_source *oldsrc, const tcc_source *patch, const tcc_logger *log, tcc_sink *sink) {
+	diagnostics diag(log);
+	return guarded(diag, [&]() {
+		return applypatch(oldsrc, patch, sink, diag);
+	});
+}
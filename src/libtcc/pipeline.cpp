@@ -0,0 +1,115 @@
+#include "pipeline.hpp"
+
+#include <cerrno>
+#include <cstdlib>
+
+rowpipeline::rowpipeline(std::span<mappedpng*> inputs, std::span<const png_bytep> slots, unsigned threads, unsigned depth) :
+	inputs(inputs), threads(threads ? threads : 1), depth(depth ? depth : 1), rings(new ring[inputs.size()]) {
+	for(size_t i = 0; i < inputs.size(); i++)
+		rings[i].slots = slots[i];
+}
+
+rowpipeline::~rowpipeline() {
+	finish();
+}
+
+int rowpipeline::start(png_int_32 y) {
+	cury.store(y, std::memory_order_release);
+	try {
+		for(unsigned i = 0; i < threads; i++)
+			workers.emplace_back(&rowpipeline::work, this, i);
+	} catch(...) {
+		finish();
+		return -EAGAIN;
+	}
+	return 0;
+}
+
+int rowpipeline::finish() {
+	if(!workers.empty()) {
+		stop.store(true, std::memory_order_relaxed);
+		epoch.fetch_add(1, std::memory_order_release);
+		epoch.notify_all();
+		for(std::thread &worker : workers)
+			worker.join();
+		workers.clear();
+	}
+	return err.load(std::memory_order_relaxed);
+}
+
+void rowpipeline::fail(ring &r, int error) {
+	int expected = 0;
+	err.compare_exchange_strong(expected, error, std::memory_order_relaxed);
+	r.done = true;
+	r.failed.store(true, std::memory_order_relaxed);
+	//Wake consumer waiting for this row
+	r.head.fetch_add(1, std::memory_order_release);
+	r.head.notify_one();
+}
+
+void rowpipeline::work(unsigned worker) {
+	//Owned inputs before first are all done
+	size_t first = worker;
+	for(;;) {
+		uint32_t e = epoch.load(std::memory_order_acquire);
+		if(stop.load(std::memory_order_relaxed))
+			return;
+		//Rows before cury are released, so rings shared with finished inputs are free
+		png_int_32 window = cury.load(std::memory_order_acquire) + (png_int_32)depth;
+		bool progress = false, remaining = false;
+		for(; first < inputs.size() && rings[first].done; first += threads);
+		for(size_t i = first; i < inputs.size(); i += threads) {
+			ring &r = rings[i];
+			mappedpng &png = *inputs[i];
+			if(r.done)
+				continue;
+			remaining = true;
+			//Inputs are sorted, so rest of them start even later
+			if(png.offset.y > window)
+				break;
+			uint32_t h = r.head.load(std::memory_order_relaxed);
+			if(h - r.consumed.load(std::memory_order_acquire) >= depth)
+				continue;
+			int ret = readrow(&png, r.slots + (size_t)(h % depth) * png.x);
+			if(ret == 0 && png.row == png.y) {
+				r.done = true;
+				ret = unmap(&png);
+			}
+			if(ret != 0) {
+				fail(r, ret);
+				continue;
+			}
+			r.head.store(h + 1, std::memory_order_release);
+			r.head.notify_one();
+			progress = true;
+		}
+		if(!remaining)
+			//Everything owned is decoded
+			return;
+		if(!progress)
+			epoch.wait(e, std::memory_order_acquire);
+	}
+}
+
+int rowpipeline::fetch(size_t input, png_bytep &pixels) {
+	ring &r = rings[input];
+	uint32_t h;
+	while((h = r.head.load(std::memory_order_acquire)) == r.tail)
+		r.head.wait(h, std::memory_order_acquire);
+	if(r.failed.load(std::memory_order_relaxed))
+		return err.load(std::memory_order_relaxed);
+	pixels = r.slots + (size_t)(r.tail % depth) * inputs[input]->x;
+	return 0;
+}
+
+void rowpipeline::release(size_t input) {
+	ring &r = rings[input];
+	r.tail++;
+	r.consumed.store(r.tail, std::memory_order_release);
+}
+
+void rowpipeline::advance(png_int_32 y) {
+	cury.store(y, std::memory_order_release);
+	epoch.fetch_add(1, std::memory_order_release);
+	epoch.notify_all();
+}
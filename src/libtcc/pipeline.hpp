@@ -0,0 +1,61 @@
+#pragma once
+
+#include "internal.hpp"
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+//Decodes rows of link inputs on worker threads ahead of the row sweep
+//Every input has single-producer single-consumer ring of decoded rows,
+//worker N owns every Nth input in sweep order and unmaps it after last row
+class rowpipeline {
+public:
+	//Inputs must be sorted by offset.y and outlive the pipeline
+	//Ring of input N is depth rows at slots[N], live from offset.y - depth until its last row
+	rowpipeline(std::span<mappedpng*> inputs, std::span<const png_bytep> slots, unsigned threads, unsigned depth);
+	~rowpipeline();
+	rowpipeline(const rowpipeline&) = delete;
+	rowpipeline &operator =(const rowpipeline&) = delete;
+
+	int start(png_int_32 y);
+
+	int activate(size_t, png_bytep &pixels) {
+		pixels = nullptr;
+		return 0;
+	}
+	//Wait for next decoded row, it is valid until release()
+	int fetch(size_t input, png_bytep &pixels);
+	void release(size_t input);
+	int deactivate(size_t, png_bytep) {
+		return 0;
+	}
+	//Sweep moved to row y, lets workers start inputs up to y + depth
+	void advance(png_int_32 y);
+	//Stop workers, returns first decode error
+	int finish();
+
+private:
+	struct ring {
+		png_bytep slots = nullptr;//depth rows
+		std::atomic<uint32_t> head{0};//Rows decoded
+		std::atomic<uint32_t> consumed{0};//Rows released by consumer
+		uint32_t tail = 0;//Consumer copy of consumed
+		bool done = false;//Producer finished this input
+		std::atomic<bool> failed{false};
+	};
+
+	void work(unsigned worker);
+	void fail(ring &r, int err);
+
+	std::span<mappedpng*> inputs;
+	unsigned threads, depth;
+	std::unique_ptr<ring[]> rings;
+	std::vector<std::thread> workers;
+	//Bumped by consumer once per row, workers sleep on it
+	std::atomic<uint32_t> epoch{0};
+	std::atomic<png_int_32> cury{0};
+	std::atomic<bool> stop{false};
+	std::atomic<int> err{0};
+};
@@ -0,0 +1,73 @@
+#include "pyramid.hpp"
+#include "rowops.hpp"
+
+#include <cerrno>
+
+int pyramid::open(std::span<tcc_sink> sinks, const mappedpng &output, diagnostics &diag) {
+	count = sinks.size();
+	levels.reset(new(std::nothrow) level[count]);
+	if(!levels) {
+		diag.error("Out of memory");
+		return -ENOMEM;
+	}
+	png_uint_32 w = output.x, h = output.y;
+	v2i32 offset = output.offset;
+	for(size_t l = 0; l < count; l++) {
+		level &lv = levels[l];
+		lv.pad = offset.x & 1;
+		lv.width = w + lv.pad;
+		lv.height = h + (offset.y & 1);
+		//Transparent row above odd first row
+		lv.rows = offset.y & 1;
+		w = (lv.width + 1) / 2;
+		h = (lv.height + 1) / 2;
+		//Arithmetic shift rounds down, so negative offsets stay on even grid too
+		offset = {offset.x >> 1, offset.y >> 1};
+		try {
+			lv.pending.assign(lv.width, 0);
+			lv.current.assign(lv.width, 0);
+			lv.row.resize(w);
+		} catch(const std::bad_alloc&) {
+			diag.error("Out of memory");
+			return -ENOMEM;
+		}
+		lv.io.png = output;
+		lv.io.png.x = w;
+		lv.io.png.y = h;
+		lv.io.png.offset = offset;
+		int err = opensink(sinks[l], lv.io, diag);
+		if(err != 0)
+			return err;
+		opened++;
+	}
+	return 0;
+}
+
+int pyramid::feed(size_t l, const uint8_t *row) {
+	level &lv = levels[l];
+	lv.rows++;
+	//Padding columns are never written and stay transparent
+	memcpy(((lv.rows & 1) ? lv.pending : lv.current).data() + lv.pad, row, lv.width - lv.pad);
+	if(lv.rows & 1) {
+		if(lv.rows < lv.height)
+			return 0;
+		//Odd last row is repeated
+		reducerow(lv.row.data(), lv.pending.data(), lv.pending.data(), lv.width);
+	} else
+		reducerow(lv.row.data(), lv.pending.data(), lv.current.data(), lv.width);
+	int err = writerow(&lv.io.png, lv.row.data());
+	if(err == 0 && l + 1 < count)
+		err = feed(l + 1, lv.row.data());
+	return err;
+}
+
+int pyramid::push(png_const_bytep row) {
+	return count ? feed(0, row) : 0;
+}
+
+int pyramid::close(std::span<tcc_sink> sinks, int err) {
+	for(size_t l = 0; l < opened; l++)
+		err = closesink(sinks[l], levels[l].io, err);
+	opened = 0;
+	return err;
+}
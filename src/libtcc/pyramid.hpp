@@ -0,0 +1,37 @@
+#pragma once
+
+#include "internal.hpp"
+
+#include <memory>
+
+//Downscaled previews of link output built while rows stream through
+//Level N halves level N - 1 by 2x2 majority, keeping one pending row per level
+//Blocks are aligned to even canvas coordinates of previous level, so previews of outputs
+//with any offsets line up, odd first column and row are paired with transparent padding
+class pyramid {
+public:
+	pyramid() = default;
+	pyramid(const pyramid&) = delete;
+	pyramid &operator =(const pyramid&) = delete;
+
+	//Open one sink per level with palette of output
+	int open(std::span<tcc_sink> sinks, const mappedpng &output, diagnostics &diag);
+	//Feed next full resolution row
+	int push(png_const_bytep row);
+	//Finish all levels, err discards outputs
+	int close(std::span<tcc_sink> sinks, int err);
+
+private:
+	struct level {
+		mappedio io;
+		std::vector<uint8_t> pending, current, row;//Padded input rows and output row
+		png_uint_32 width, height;//Of padded input
+		png_uint_32 pad;//Transparent columns before input
+		png_uint_32 rows = 0;//Padded input rows seen
+	};
+
+	int feed(size_t l, const uint8_t *row);
+
+	std::unique_ptr<level[]> levels;
+	size_t count = 0, opened = 0;
+};
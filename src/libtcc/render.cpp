@@ -0,0 +1,108 @@
+#include "internal.hpp"
+#include "rowops.hpp"
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdlib>
+
+void buildlut(const mappedpng &png, const uint8_t bg[4], uint32_t lut[256]) {
+	for(int i = 0; i < 256; i++) {
+		if(i >= png.paletted.numcolors) {
+			lut[i] = packrgba(bg[0], bg[1], bg[2], bg[3]);
+			continue;
+		}
+		const color_t &c = png.paletted.plt[i];
+		unsigned a = i < png.paletted.numtransparent ? png.paletted.alpha[i] : 255;
+		if(a == 255 || bg[3] == 0) {
+			lut[i] = packrgba(c.red, c.green, c.blue, a);
+			continue;
+		}
+		//Straight alpha over
+		float sa = a / 255.f, ba = bg[3] / 255.f * (1 - sa), oa = sa + ba;
+		auto mix = [&](uint8_t s, uint8_t b) {
+			return (uint8_t)((s * sa + b * ba) / oa + .5f);
+		};
+		lut[i] = packrgba(mix(c.red, bg[0]), mix(c.green, bg[1]), mix(c.blue, bg[2]), (uint8_t)(oa * 255 + .5f));
+	}
+}
+
+static int renderimage(const tcc_source *src, const tcc_render_options *opt, tcc_sink *sink, diagnostics &diag) {
+	mappedio in;
+	int err = opensource(*src, in, diag);
+	if(err != 0)
+		return err;
+	mappedpng &png = in.png;
+	if(png.colorType != PNG_COLOR_TYPE_PALETTE) {
+		diag.error("File %s is not a compiled template", in.name);
+		unmap(&png);
+		return -EINVAL;
+	}
+	uint32_t lut[256];
+	buildlut(png, opt->background, lut);
+
+	//Template position in output
+	bool canvas = opt->canvaswidth && opt->canvasheight;
+	v2i32 place = canvas ? png.offset : v2i32{0, 0};
+	mappedio out;
+	mappedpng &output = out.png;
+	output.x = canvas ? opt->canvaswidth : png.x;
+	output.y = canvas ? opt->canvasheight : png.y;
+	output.colorType = PNG_COLOR_TYPE_RGBA;
+	output.bitDepth = 8;
+	output.offset = canvas ? v2i32{0, 0} : png.offset;
+	output.write = true;
+	//Visible columns of template
+	int64_t left = std::max<int64_t>(0, -(int64_t)place.x);
+	int64_t right = std::min<int64_t>(png.x, (int64_t)output.x - place.x);
+	if(canvas && (right <= left || place.y >= (int64_t)output.y || place.y + (int64_t)png.y <= 0))
+		diag.warn("%s is outside of canvas", in.name);
+
+	const uint32_t bg = packrgba(opt->background[0], opt->background[1], opt->background[2], opt->background[3]);
+	std::vector<uint32_t> row;
+	std::vector<uint8_t> indices;
+	try {
+		row.assign(output.x, bg);
+		indices.resize(png.x);
+	} catch(const std::bad_alloc&) {
+		diag.error("Out of memory");
+		unmap(&png);
+		return -ENOMEM;
+	}
+	err = opensink(*sink, out, diag);
+	if(err != 0) {
+		unmap(&png);
+		return err;
+	}
+	//Rows above canvas
+	for(int64_t y = place.y; y < 0 && png.row < png.y && err == 0; y++)
+		err = readrow(&png, indices.data());
+	for(int64_t y = 0; y < output.y && err == 0; y++) {
+		int64_t ty = y - place.y;
+		if(ty >= 0 && ty < png.y && right > left) {
+			err = readrow(&png, indices.data());
+			if(err != 0)
+				break;
+			expandrow(row.data() + place.x + left, indices.data() + left, lut, right - left);
+		} else if(ty == png.y && right > left)
+			//Template ended, restore background under it
+			std::fill(row.begin() + place.x + left, row.begin() + place.x + right, bg);
+		err = writerow(&output, (png_const_bytep)row.data());
+	}
+	err = closesink(*sink, out, err);
+	int ret = unmap(&png);
+	if(err == 0)
+		err = ret;
+	if(err == 0)
+		diag.info("Info: rendered %s to %" PRIu32 "x%" PRIu32, in.name, output.x, output.y);
+	return err;
+}
+
+int tcc_render(const tcc_source *src, const tcc_render_options *opt, tcc_sink *sink) {
+	const tcc_render_options defaults = {};
+	if(!opt)
+		opt = &defaults;
+	diagnostics diag(opt->log);
+	return guarded(diag, [&]() {
+		return renderimage(src, opt, sink, diag);
+	});
+}
@@ -0,0 +1,251 @@
+#pragma once
+
+//Vectorized kernels over rows of palette indices, index 0 is transparent
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+//out = in where in is opaque
+inline void paintrow(uint8_t *out, const uint8_t *in, size_t n) {
+	size_t i = 0;
+#ifdef __SSE2__
+	const __m128i zero = _mm_setzero_si128();
+	for(; i + 16 <= n; i += 16) {
+		__m128i s = _mm_loadu_si128((const __m128i*)(in + i));
+		__m128i d = _mm_loadu_si128((const __m128i*)(out + i));
+		//Keep destination only where source is transparent
+		d = _mm_or_si128(_mm_and_si128(d, _mm_cmpeq_epi8(s, zero)), s);
+		_mm_storeu_si128((__m128i*)(out + i), d);
+	}
+#endif
+	for(; i < n; i++)
+		if(in[i])
+			out[i] = in[i];
+}
+
+//Count pixels where both rows are opaque and differ
+//Marks them with 1 in mask when it is not NULL, first receives position of the first one
+inline size_t conflictrow(const uint8_t *a, const uint8_t *b, size_t n, uint8_t *mask, size_t &first) {
+	size_t i = 0, count = 0;
+	first = n;
+#ifdef __SSE2__
+	const __m128i zero = _mm_setzero_si128(), one = _mm_set1_epi8(1);
+	for(; i + 16 <= n; i += 16) {
+		__m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+		__m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+		//Agreeing or transparent lanes
+		__m128i ok = _mm_or_si128(_mm_cmpeq_epi8(va, vb), _mm_or_si128(_mm_cmpeq_epi8(va, zero), _mm_cmpeq_epi8(vb, zero)));
+		unsigned bits = ~_mm_movemask_epi8(ok) & 0xFFFF;
+		if(!bits)
+			continue;
+		if(first == n)
+			first = i + __builtin_ctz(bits);
+		count += __builtin_popcount(bits);
+		if(mask) {
+			__m128i m = _mm_loadu_si128((const __m128i*)(mask + i));
+			m = _mm_or_si128(m, _mm_andnot_si128(ok, one));
+			_mm_storeu_si128((__m128i*)(mask + i), m);
+		}
+	}
+#endif
+	for(; i < n; i++)
+		if(a[i] && b[i] && a[i] != b[i]) {
+			if(first == n)
+				first = i;
+			count++;
+			if(mask)
+				mask[i] = 1;
+		}
+	return count;
+}
+
+//Most frequent of 2x2 block, opaque wins ties with transparent, otherwise first in scan order wins
+inline uint8_t majority(uint8_t a, uint8_t b, uint8_t c, uint8_t d) {
+	const uint8_t v[4] = {a, b, c, d};
+	uint8_t best = 0;
+	int bestn = 0;
+	for(int i = 0; i < 4; i++) {
+		int n = (v[i] == a) + (v[i] == b) + (v[i] == c) + (v[i] == d);
+		if(n > bestn || (n == bestn && best == 0 && v[i] != 0)) {
+			best = v[i];
+			bestn = n;
+		}
+	}
+	return best;
+}
+
+//Halve pair of rows of width n, odd last column is repeated
+inline void reducerow(uint8_t *out, const uint8_t *top, const uint8_t *bottom, size_t n) {
+	size_t i = 0;
+#ifdef __SSE2__
+	const __m128i low = _mm_set1_epi16(0x00FF);
+	for(; i + 16 <= n / 2; i += 16) {
+		__m128i t0 = _mm_loadu_si128((const __m128i*)(top + i * 2));
+		__m128i t1 = _mm_loadu_si128((const __m128i*)(top + i * 2 + 16));
+		__m128i b0 = _mm_loadu_si128((const __m128i*)(bottom + i * 2));
+		__m128i b1 = _mm_loadu_si128((const __m128i*)(bottom + i * 2 + 16));
+		//Split even and odd columns
+		__m128i te = _mm_packus_epi16(_mm_and_si128(t0, low), _mm_and_si128(t1, low));
+		__m128i to = _mm_packus_epi16(_mm_srli_epi16(t0, 8), _mm_srli_epi16(t1, 8));
+		__m128i be = _mm_packus_epi16(_mm_and_si128(b0, low), _mm_and_si128(b1, low));
+		__m128i bo = _mm_packus_epi16(_mm_srli_epi16(b0, 8), _mm_srli_epi16(b1, 8));
+		//Uniform blocks are the common case
+		__m128i same = _mm_and_si128(_mm_and_si128(_mm_cmpeq_epi8(te, to), _mm_cmpeq_epi8(be, bo)), _mm_cmpeq_epi8(te, be));
+		if(_mm_movemask_epi8(same) == 0xFFFF) {
+			_mm_storeu_si128((__m128i*)(out + i), te);
+			continue;
+		}
+		for(size_t j = i; j < i + 16; j++)
+			out[j] = majority(top[j * 2], top[j * 2 + 1], bottom[j * 2], bottom[j * 2 + 1]);
+	}
+#endif
+	for(; i < n / 2; i++)
+		out[i] = majority(top[i * 2], top[i * 2 + 1], bottom[i * 2], bottom[i * 2 + 1]);
+	if(n & 1)
+		out[i] = majority(top[n - 1], top[n - 1], bottom[n - 1], bottom[n - 1]);
+}
+
+//out = lut[in], 4 bytes per pixel
+inline void expandrow(uint32_t *out, const uint8_t *in, const uint32_t *lut, size_t n) {
+	size_t i = 0;
+#ifdef __AVX2__
+	for(; i + 8 <= n; i += 8) {
+		__m256i idx = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(in + i)));
+		_mm256_storeu_si256((__m256i*)(out + i), _mm256_i32gather_epi32((const int*)lut, idx, 4));
+	}
+#endif
+	//Without gather table loads are as good as it gets, unroll to keep them in flight
+	for(; i + 4 <= n; i += 4) {
+		uint32_t a = lut[in[i]], b = lut[in[i + 1]], c = lut[in[i + 2]], d = lut[in[i + 3]];
+		out[i] = a;
+		out[i + 1] = b;
+		out[i + 2] = c;
+		out[i + 3] = d;
+	}
+	for(; i < n; i++)
+		out[i] = lut[in[i]];
+}
+
+//Position of first byte where rows differ, n when they are equal
+inline size_t firstdiff(const uint8_t *a, const uint8_t *b, size_t n) {
+	size_t i = 0;
+#ifdef __SSE2__
+	for(; i + 16 <= n; i += 16) {
+		__m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+		__m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+		unsigned bits = ~_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) & 0xFFFF;
+		if(bits)
+			return i + __builtin_ctz(bits);
+	}
+#endif
+	for(; i < n; i++)
+		if(a[i] != b[i])
+			return i;
+	return n;
+}
+
+//Add index counts of row to split counters, which are summed by caller
+//Splitting keeps repeated indices from waiting on the same counter,
+//uniform 16 byte blocks are counted at once
+template<class counter, size_t split>
+inline void histrow(counter (*counts)[256], const uint8_t *row, size_t n) {
+	size_t i = 0;
+#ifdef __SSE2__
+	for(; i + 16 <= n; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(row + i));
+		if(_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(row[i]))) == 0xFFFF) {
+			counts[0][row[i]] += 16;
+			continue;
+		}
+		for(size_t j = 0; j < 16; j += 8) {
+			uint64_t word;
+			memcpy(&word, row + i + j, 8);
+			for(size_t k = 0; k < 8; k++, word >>= 8)
+				counts[k % split][word & 0xFF]++;
+		}
+	}
+#endif
+	for(; i < n; i++)
+		counts[i % split][row[i]]++;
+}
+
+//RGBA pixels in memory order RGBA, alpha 0 is transparent
+
+inline uint8_t alphaof(uint32_t px) {
+	uint8_t b[4];
+	memcpy(b, &px, 4);
+	return b[3];
+}
+
+//out = in where in is not transparent
+//Counts pixels where both rows are not transparent and differ, first receives position of the first one
+inline size_t paintrgba(uint32_t *out, const uint32_t *in, size_t n, size_t &first) {
+	size_t i = 0, count = 0;
+	first = n;
+#ifdef __SSE2__
+	const __m128i alpha = _mm_set1_epi32((int)0xFF000000), zero = _mm_setzero_si128();
+	for(; i + 4 <= n; i += 4) {
+		__m128i s = _mm_loadu_si128((const __m128i*)(in + i));
+		__m128i d = _mm_loadu_si128((const __m128i*)(out + i));
+		__m128i sclear = _mm_cmpeq_epi32(_mm_and_si128(s, alpha), zero);
+		__m128i dclear = _mm_cmpeq_epi32(_mm_and_si128(d, alpha), zero);
+		//Agreeing or transparent lanes
+		__m128i ok = _mm_or_si128(_mm_cmpeq_epi32(s, d), _mm_or_si128(sclear, dclear));
+		unsigned bits = ~_mm_movemask_ps(_mm_castsi128_ps(ok)) & 0xF;
+		if(bits) {
+			if(first == n)
+				first = i + __builtin_ctz(bits);
+			count += __builtin_popcount(bits);
+		}
+		d = _mm_or_si128(_mm_and_si128(d, sclear), _mm_andnot_si128(sclear, s));
+		_mm_storeu_si128((__m128i*)(out + i), d);
+	}
+#endif
+	for(; i < n; i++) {
+		if(!alphaof(in[i]))
+			continue;
+		if(alphaof(out[i]) && out[i] != in[i]) {
+			if(first == n)
+				first = i;
+			count++;
+		}
+		out[i] = in[i];
+	}
+	return count;
+}
+
+//Count pixels that are neither transparent nor opaque, first receives position of the first one
+inline size_t partialrgba(const uint32_t *in, size_t n, size_t &first) {
+	size_t i = 0, count = 0;
+	first = n;
+#ifdef __SSE2__
+	const __m128i alpha = _mm_set1_epi32((int)0xFF000000), zero = _mm_setzero_si128();
+	for(; i + 4 <= n; i += 4) {
+		__m128i a = _mm_and_si128(_mm_loadu_si128((const __m128i*)(in + i)), alpha);
+		__m128i ok = _mm_or_si128(_mm_cmpeq_epi32(a, zero), _mm_cmpeq_epi32(a, alpha));
+		unsigned bits = ~_mm_movemask_ps(_mm_castsi128_ps(ok)) & 0xF;
+		if(bits) {
+			if(first == n)
+				first = i + __builtin_ctz(bits);
+			count += __builtin_popcount(bits);
+		}
+	}
+#endif
+	for(; i < n; i++) {
+		uint8_t a = alphaof(in[i]);
+		if(a != 0 && a != 255) {
+			if(first == n)
+				first = i;
+			count++;
+		}
+	}
+	return count;
+}
@@ -0,0 +1,251 @@
+#pragma once
+
+//libtcc - template compiler as a library
+//All functions return 0 on success or negative errno value on failure,
+//details are reported through the logger
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef _MSC_VER
+#define TCC_API
+#else
+#define TCC_API __attribute__((visibility("default")))
+#endif
+
+enum tcc_verbosity {
+	TCC_QUIET,//Errors only
+	TCC_NORMAL,//Errors, warnings and summaries
+	TCC_VERBOSE//Everything including per-file info
+};
+
+enum tcc_loglevel {
+	TCC_LOG_ERROR,
+	TCC_LOG_WARN,
+	TCC_LOG_INFO
+};
+
+//Message sink, NULL fn prints to stdout/stderr
+//May be called from worker threads
+struct tcc_logger {
+	void (*fn)(void *user, enum tcc_loglevel level, const char *msg);
+	void *user;
+	enum tcc_verbosity verbosity;
+};
+
+//Input PNG, read from path when it is not NULL, otherwise from data
+//Path "-" is standard input
+struct tcc_source {
+	const char *path;
+	const void *data;
+	size_t size;
+};
+
+//Output PNG, written to path when it is not NULL, otherwise to data
+//allocated by libtcc, release it with tcc_free()
+//Path "-" is standard output, messages of the same run should not go there
+struct tcc_sink {
+	const char *path;
+	void *data;
+	size_t size;
+};
+
+//Loaded palette, can be shared between calls and threads
+struct tcc_palette;
+
+//Load palette from RGB or RGBA image, every unique opaque color is added
+TCC_API int tcc_palette_load(const struct tcc_source *src, const struct tcc_logger *log, struct tcc_palette **plt);
+//Create palette from packed RGB triplets
+TCC_API int tcc_palette_create(const uint8_t *rgb, size_t count, struct tcc_palette **plt);
+//Number of colors, not counting transparent index 0
+TCC_API size_t tcc_palette_size(const struct tcc_palette *plt);
+TCC_API void tcc_palette_free(struct tcc_palette *plt);
+
+enum tcc_dither {
+	TCC_DITHER_NONE,//Colors must be in palette
+	TCC_DITHER_ORDERED,//8x8 Bayer matrix
+	TCC_DITHER_FLOYD,//Floyd-Steinberg error diffusion
+	TCC_DITHER_ATKINSON//Atkinson error diffusion
+};
+
+//Zero-initialized options are defaults
+struct tcc_compile_options {
+	int32_t offsetx, offsety;
+	//Crop transparent border and move offset accordingly
+	int trim;
+	//Map RGBA colors missing from palette to nearest ones, paletted inputs must still match
+	enum tcc_dither dither;
+	//Palette index counts of output as JSON, optional
+	struct tcc_sink *histogram;
+	//Also count per tile of grid aligned to canvas coordinates, 0 is totals only
+	//Counters of all tiles are limited to 256 MiB, about 128K tiles, larger grids fail with -ERANGE
+	uint32_t histogramtile;
+	const struct tcc_logger *log;
+};
+
+//Palettize RGBA or paletted PNG and write compiled template with offset
+TCC_API int tcc_compile(const struct tcc_palette *plt, const struct tcc_source *input, const struct tcc_compile_options *opt, struct tcc_sink *output);
+//Palettize RGBA pixels, index 0 is transparent and index N is palette color N - 1
+TCC_API int tcc_compile_pixels(const struct tcc_palette *plt, const uint8_t *rgba, uint32_t width, uint32_t height, size_t stride,
+	uint8_t *out, size_t outstride, const struct tcc_logger *log);
+
+//Pixels where two inputs are opaque and disagree
+struct tcc_conflict {
+	size_t a, b;//Input indices, b is later and wins
+	uint64_t pixels;
+};
+
+struct tcc_link_report {
+	//Sorted by pixels, release with tcc_free()
+	struct tcc_conflict *conflicts;
+	size_t numconflicts;
+	uint64_t conflictpixels;
+};
+
+struct tcc_link_options {
+	//Decode inputs on this many worker threads ahead of the writer,
+	//0 decodes on the calling thread
+	unsigned threads;
+	//Rows decoded ahead per input, 0 is default
+	unsigned depth;
+	//Mask of conflicting pixels with the same geometry as output, optional
+	struct tcc_sink *conflictmask;
+	//Previews downscaled by 2, 4, 8... with 2x2 majority of palette indices,
+	//blocks are aligned to even canvas coordinates and offset is output offset divided rounding down
+	struct tcc_sink *previews;
+	size_t numpreviews;
+	//Palette index counts of output and of every input as JSON, optional
+	struct tcc_sink *histogram;
+	//Also count output per tile of grid aligned to canvas coordinates, 0 is totals only
+	//Counters of all tiles are limited to 256 MiB, about 128K tiles, larger grids fail with -ERANGE
+	uint32_t histogramtile;
+	//Filled on success when not NULL
+	struct tcc_link_report *report;
+	const struct tcc_logger *log;
+};
+
+//Link compiled templates into one template covering all of them
+//Where opaque pixels of overlapping inputs disagree, later input wins
+TCC_API int tcc_link(const struct tcc_source *inputs, size_t count, const struct tcc_link_options *opt, struct tcc_sink *output);
+
+//Output of tcc_link_targets()
+struct tcc_link_target {
+	//Indices of inputs linked into this output, NULL takes all of them
+	const size_t *inputs;
+	size_t numinputs;
+	//Clip to rectangle in canvas coordinates when width and height are not 0
+	int32_t clipx, clipy;
+	uint32_t clipwidth, clipheight;
+	struct tcc_sink *output;
+};
+
+//Link several outputs from subsets of inputs in one pass
+//Every input row is decoded once and outputs are encoded in parallel,
+//conflict mask, previews and histogram of options are not supported
+TCC_API int tcc_link_targets(const struct tcc_source *inputs, size_t count, const struct tcc_link_target *targets, size_t numtargets, const struct tcc_link_options *opt);
+
+struct tcc_check_options {
+	//Worker threads, 0 is one per CPU
+	unsigned threads;
+	//Skip decoding pixels, which looks for indices past palette
+	int headersonly;
+	const struct tcc_logger *log;
+};
+
+//Validate inputs of tcc_link() in parallel without writing anything
+//Problems are reported through the logger, overlaps only in verbose mode
+TCC_API int tcc_check(const struct tcc_source *inputs, size_t count, const struct tcc_check_options *opt);
+
+struct tcc_index_options {
+	//Rows between restart points, 0 is default
+	uint32_t span;
+	const struct tcc_logger *log;
+};
+
+//Build sidecar index of decoder restart points for tcc_crop(), any 8 bit non-interlaced PNG works
+TCC_API int tcc_index(const struct tcc_source *png, const struct tcc_index_options *opt, struct tcc_sink *index);
+
+struct tcc_crop_options {
+	//Region in canvas coordinates, clipped to image
+	int32_t x, y;
+	uint32_t width, height;
+	const struct tcc_logger *log;
+};
+
+//Extract region decoding only rows from nearest restart point, output keeps palette and gets offset of region
+TCC_API int tcc_crop(const struct tcc_source *png, const struct tcc_source *index, const struct tcc_crop_options *opt, struct tcc_sink *output);
+
+struct tcc_render_options {
+	//Place template at its offset on canvas of this size with origin at 0,0,
+	//zero keeps template geometry and offset
+	uint32_t canvaswidth, canvasheight;
+	//RGBA, template is composited over it
+	uint8_t background[4];
+	const struct tcc_logger *log;
+};
+
+//Expand compiled template back to RGBA
+TCC_API int tcc_render(const struct tcc_source *input, const struct tcc_render_options *opt, struct tcc_sink *output);
+
+//Catalog of template headers with spatial index, can be shared between threads
+struct tcc_catalog;
+
+struct tcc_catalog_entry {
+	const char *name;//Path given at build, empty for memory sources
+	int32_t x, y;
+	uint32_t width, height;
+	uint32_t palette;//CRC of PLTE, equal palettes have equal values
+	int colortype;//PNG color type
+	int compiled;//8 bit paletted with only index 0 transparent
+};
+
+struct tcc_catalog_options {
+	//Worker threads, 0 is one per CPU
+	unsigned threads;
+	const struct tcc_logger *log;
+};
+
+//Read IHDR, PLTE, tRNS and oFFs of inputs without decoding them and write catalog
+TCC_API int tcc_catalog_build(const struct tcc_source *inputs, size_t count, const struct tcc_catalog_options *opt, struct tcc_sink *catalog);
+TCC_API int tcc_catalog_load(const struct tcc_source *src, const struct tcc_logger *log, struct tcc_catalog **cat);
+TCC_API size_t tcc_catalog_size(const struct tcc_catalog *cat);
+TCC_API void tcc_catalog_get(const struct tcc_catalog *cat, size_t index, struct tcc_catalog_entry *entry);
+//Find entries intersecting rectangle in no particular order
+//Up to cap indices are stored, total number of entries found is returned
+TCC_API size_t tcc_catalog_query(const struct tcc_catalog *cat, int32_t x, int32_t y, uint32_t width, uint32_t height, size_t *indices, size_t cap);
+TCC_API void tcc_catalog_free(struct tcc_catalog *cat);
+
+//Layer of tcc_layers(), sources are paletted, RGB or RGBA and placed at their offsets
+struct tcc_layer {
+	//Composed into output, optional
+	const struct tcc_source *image;
+	//Composed into mask output, optional
+	const struct tcc_source *mask;
+	//Mask colors are multiplied by it and the whole mask becomes opaque, 1 keeps mask as is
+	float maskfactor;
+};
+
+struct tcc_layers_options {
+	const struct tcc_logger *log;
+};
+
+//Compose stack of layers into RGBA output and RGBA mask in one pass, either sink may be NULL
+//Later layers are on top, their pixels win where they are not transparent
+//Both outputs cover all layers and have the same geometry
+TCC_API int tcc_layers(const struct tcc_layer *layers, size_t count, const struct tcc_layers_options *opt, struct tcc_sink *output, struct tcc_sink *mask);
+
+//Write changed spans and new geometry between two versions of compiled template
+TCC_API int tcc_patch(const struct tcc_source *oldinput, const struct tcc_source *newinput, const struct tcc_logger *log, struct tcc_sink *patch);
+//Rebuild new version from old one and patch, pixels are verified against checksums in patch
+TCC_API int tcc_apply(const struct tcc_source *oldinput, const struct tcc_source *patch, const struct tcc_logger *log, struct tcc_sink *output);
+
+TCC_API void tcc_free(void *data);
+TCC_API const char *tcc_strerror(int err);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,146 +1,54 @@
-#include "common/png.h"
+#include "libtcc/tcc.h"
 
+#include <algorithm>
+#include <fstream>
 #include <iostream>
+#include <sstream>
+#include <cstdio>
 #include <cstdlib>
 #include <vector>
 #include <cstdint>
-#include <cinttypes>
-#include <memory.h>
-#include <span>
-#include <set>
-#include <algorithm>
-
-typedef png_color color_t;
-
-constexpr inline bool operator ==(const color_t &a, const color_t &b) {
-	return a.red == b.red && a.green == b.green && a.blue == b.blue;
-}
-
-constexpr inline v2i32 operator +(const v2i32 &a, const v2i32 &b) {
-	return {a.x + b.x, a.y + b.y};
-}
-
-constexpr inline v2i32 operator -(const v2i32 &a, const v2i32 &b) {
-	return {a.x - b.x, a.y - b.y};
-}
-
-constexpr inline bool operator <(const v2i32 &a, const v2i32 &b) {
-	return a.x < b.x && a.y < b.y;
-}
-constexpr inline bool operator >(const v2i32 &a, const v2i32 &b) {
-	return a.x > b.x && a.y > b.y;
-}
-
-constexpr inline v2i32 minel(const v2i32 &a, const v2i32 &b) {
-	return {a.x < b.x ? a.x : b.x, a.y < b.y ? a.y : b.y};
-}
-constexpr inline v2i32 maxel(const v2i32 &a, const v2i32 &b) {
-	return {a.x > b.x ? a.x : b.x, a.y > b.y ? a.y : b.y};
-}
-
-
-//Get palette-to-palette table
-//Output plt color 0 is transparent
-static std::vector<uint8_t> plt2pltTable(std::span<const color_t> input, std::span<const uint8_t> inputAlpha, std::vector<color_t> &outputPlt, bool allowGrowth) {
-	size_t len = input.size(), alen = inputAlpha.size();
-	std::vector<uint8_t> pltpair;
-	bool alphaerr = false;
-	for(size_t i = 0; i < len; i++) {
-		if(i < alen && inputAlpha[i] != 255) {
-			if(inputAlpha[i] != 0 && !alphaerr) {
-				std::cerr << "Paletted image uses color with alpha neither 255 nor 0, marking as transparent" << std::endl;
-				alphaerr = true;
-			}
-			pltpair.push_back(0);
-		} else {
-			color_t color = input[i];
-			size_t index, outlen = outputPlt.size();
-			for(index = 0; index < outlen && outputPlt[index] != color; index++);
-			if(index == outlen) {
-				if(!allowGrowth) {
-					std::cerr << "Image wants color that does not exist in palette" << std::endl;
-					exit(-1);
-				}
-				if(index == 255) {
-					std::cerr << "Palette merge results in too big palette" << std::endl;
-					//Oh shit
-					exit(-1);
-				}
-				outputPlt.push_back(color);
-			}
-			pltpair.push_back(index + 1);
-		}
-	}
-
-	return pltpair;
-}
-
-static png_bytep readPNG(mappedpng &png) {
-	png_bytepp rows = (png_bytepp)alloca(png.y * sizeof(png_bytepp));
-	size_t stride = png.colorType == PNG_COLOR_TYPE_RGB ? 3 : (png.colorType == PNG_COLOR_TYPE_PALETTE ? 1 : 4);
-	png_bytep data = (png_bytep)malloc(png.x * png.y * stride);
-	if(!data)
-		abort();
-	size_t offset = 0;
-	for(png_uint_32 i = 0; i < png.y; i++) {
-		rows[i] = data + offset;
-		offset += png.x * stride;
-	}
-	png_read_image(png.ptr, rows);
-	return data;
-}
-
-static void readPalette(const char *path, std::vector<color_t> &plt) {
-	struct mappedpng png = map(path);
-	if(png.colorType != PNG_COLOR_TYPE_RGB && png.colorType != PNG_COLOR_TYPE_RGBA) {
-		std::cerr << "Cant read palette from image type " << png.colorType << std::endl;
-		exit(-1);
-	}
-	//Read PNG
-	if(png.x > 255 || png.x * png.y > 255) {
-		std::cerr << "Palette image is too big" << std::endl;
-		exit(-1);
-	}
-	png_bytep data = readPNG(png);
-	//Clear just in case
-	plt.clear();
-
-	if(png.colorType == PNG_COLOR_TYPE_RGB) {
-		//Start reading
-		size_t offset = 0, size = png.x * png.y * 3;
-		for(; offset < size; offset += 3) {
-			const color_t color{data[offset], data[offset + 1], data[offset + 2]};
-			//Add only unique
-			if(std::find(plt.begin(), plt.end(), color) == plt.end())
-				plt.push_back(color);
-		}
-	} else if(png.colorType == PNG_COLOR_TYPE_RGBA) {
-		size_t offset = 0, size = png.x * png.y * 4;
-		for(; offset < size; offset += 4) {
-			const color_t color{data[offset], data[offset + 1], data[offset + 2]};
-			const uint8_t alpha = data[offset + 3];
-			//Skip transparent
-			if(alpha == 0)
-				continue;
-			else if(alpha != 255) {
-				std::cout << "Palette image has pixel with color != 255 and != 0, skipping" << std::endl;
-				continue;
-			}
-			//Add only unique
-			if(std::find(plt.begin(), plt.end(), color) == plt.end())
-				plt.push_back(color);
-		}
-	} else {//paletted image
-//		std::vector<color_t> palette;
-		plt2pltTable(std::span<color_t>(png.paletted.plt, png.paletted.numcolors), std::span<const uint8_t>(png.paletted.alpha, png.paletted.numtransparent), plt, true);
-		plt.insert(plt.begin(), {0, 0, 0});
+#include <climits>
+#include <cerrno>
+#include <string>
+#include <string_view>
+
+static int compile(const tcc_logger &log, int argc, const char * const *argv) {
+	tcc_compile_options opt{};
+	tcc_sink histogram{nullptr, nullptr, 0};
+	opt.log = &log;
+	for(; argc > 0 && argv[0][0] == '-' && argv[0][1] != '\0'; argc--, argv++) {
+		std::string_view name(argv[0]);
+		if(name == "-trim")
+			opt.trim = 1;
+		else if(name == "-dither" && argc >= 2) {
+			std::string_view mode(argv[1]);
+			if(mode == "bayer")
+				opt.dither = TCC_DITHER_ORDERED;
+			else if(mode == "floyd")
+				opt.dither = TCC_DITHER_FLOYD;
+			else if(mode == "atkinson")
+				opt.dither = TCC_DITHER_ATKINSON;
+			else
+				goto usage;
+			argc--;
+			argv++;
+		} else if(name == "-histogram" && argc >= 2) {
+			histogram.path = argv[1];
+			opt.histogram = &histogram;
+			argc--;
+			argv++;
+		} else if(name == "-tile" && argc >= 2) {
+			char *conv;
+			long value = std::strtol(argv[1], &conv, 10);
+			if(conv == argv[1] || value < 1 || value > INT32_MAX)
+				goto usage;
+			opt.histogramtile = value;
+			argc--;
+			argv++;
+		} else
+			goto usage;
 	}
-
-	free(data);
-	unmap(&png);
-}
-
-void compile(int argc, const char * const *argv) {
 	if(argc != 5)
 		goto usage;
 	{
@@ -152,290 +60,521 @@ void compile(int argc, const char * const *argv) {
 		if(conv==argv[3])
 			//Not a number
 			goto usage;
-		if(offsetX == LONG_MAX)
+		if(offsetX > INT32_MAX || offsetX < INT32_MIN)
 			//Too big number
 			goto overrange;
 		offsetY = std::strtol(argv[4], &conv, 10);
 		if(conv==argv[4])
 			//Not a number
 			goto usage;
-		if(offsetY == LONG_MAX)
+		if(offsetY > INT32_MAX || offsetY < INT32_MIN)
 			//Too big number
 			goto overrange;
 	}
 
 	//Read palette
-	std::vector<color_t> palette;
-	readPalette(palette_file, palette);
+	tcc_palette *palette;
+	tcc_source pltsrc{palette_file, nullptr, 0};
+	int err = tcc_palette_load(&pltsrc, &log, &palette);
+	if(err != 0)
+		return err;
+
+	tcc_source input{input_file, nullptr, 0};
+	tcc_sink output{output_file, nullptr, 0};
+	opt.offsetx = offsetX;
+	opt.offsety = offsetY;
+	err = tcc_compile(palette, &input, &opt, &output);
+	tcc_palette_free(palette);
+	return err;
+	}
+
+	usage:
+	std::cout << "Compile tool usage: [-trim] [-dither bayer|floyd|atkinson] [-histogram JSON [-tile SIZE]] OUTPUT PALETTE INPUT OFFSETX OFFSETY\n"
+		"\tOUTPUT and INPUT may be - for standard output and input\n"
+		"\t-trim       Crop transparent border and adjust offset\n"
+		"\t-dither     Map colors missing from palette to nearest ones with dithering\n"
+		"\t-histogram  Write palette index counts of output\n"
+		"\t-tile       Also count per SIZE x SIZE tile of canvas\n";
+	return -EINVAL;
 
-	//Read input, palletize and write output
-	mappedpng input = map(input_file);
-	png_bytep data = nullptr;
-	if(input.colorType == PNG_COLOR_TYPE_PALETTE) {
-		std::vector<uint8_t> pltpair =
-				plt2pltTable(std::span<color_t>(input.paletted.plt, input.paletted.numcolors), std::span<const uint8_t>(input.paletted.alpha, input.paletted.numtransparent), palette, false);
-		data = readPNG(input);
-		size_t size = input.x * input.y;
-		for(size_t i = 0; i < size; i++)
-			data[i] = pltpair[data[i]];
-	} else if(input.colorType == PNG_COLOR_TYPE_RGBA) {
-		png_bytep indata = readPNG(input);
-		size_t offset = 0, size = input.x * input.y;
-		data = (png_bytep)malloc(size);
-		if(!data)
-			abort();
-		size *= 4;
-		for(size_t i = 0; offset < size; offset += 4, i++) {
-			const color_t color{indata[offset], indata[offset + 1], indata[offset + 2]};
-			const uint8_t alpha = indata[offset + 3];
-			if(alpha != 255) {
-				if(alpha)
-					std::cout << "Image has pixel with color != 255 and != 0, marking transparent" << std::endl;
-				data[i] = 0;
+	overrange:
+	std::cerr << "Offset is too big\n";
+	return -ERANGE;
+}
+
+//Manifest lines are OUTPUT [-clip X Y WIDTH HEIGHT] [INPUT...], # starts comment
+//Inputs are paths given on command line, output without them takes all
+static int linkmanifest(const char *path, const tcc_link_options &opt, int argc, char **argv) {
+	std::ifstream file(path);
+	if(!file) {
+		std::cerr << "Can not open manifest " << path << '\n';
+		return -ENOENT;
+	}
+	std::vector<std::string> outputs;
+	std::vector<std::vector<size_t>> subsets;
+	std::vector<tcc_link_target> targets;
+	std::string line;
+	for(size_t n = 1; std::getline(file, line); n++) {
+		std::istringstream words(line.substr(0, line.find('#')));
+		std::string word;
+		if(!(words >> word))
+			continue;
+		tcc_link_target target{};
+		outputs.push_back(word);
+		subsets.emplace_back();
+		while(words >> word) {
+			if(word == "-clip") {
+				long long x, y, w, h;
+				if(!(words >> x >> y >> w >> h) || x < INT32_MIN || x > INT32_MAX || y < INT32_MIN || y > INT32_MAX
+						|| w < 1 || w > UINT32_MAX || h < 1 || h > UINT32_MAX) {
+					std::cerr << path << ':' << n << ": bad clip rectangle\n";
+					return -EINVAL;
+				}
+				target.clipx = x;
+				target.clipy = y;
+				target.clipwidth = w;
+				target.clipheight = h;
 				continue;
 			}
-			//Find color
-			auto it = std::find(palette.begin(), palette.end(), color);
-			if(it == palette.end()) {
-				//Color not found in palette
-				png_uint_32 x, y;
-				y = offset / (input.x * 4);
-				x = (offset % (input.x * 4)) / 4;
-				//NOTE: how compiler should behave?
-				std::cerr << "Out-of-palette color at x=" << x << " y=" << y << ", marking transparent" << std::endl;
-				data[i] = 0;
-			} else {
-				data[i] = std::distance(palette.begin(), it) + 1;
+			char **input = std::find_if(argv, argv + argc, [&word](const char *arg) {
+				return word == arg;
+			});
+			if(input == argv + argc) {
+				std::cerr << path << ':' << n << ": " << word << " is not among inputs\n";
+				return -EINVAL;
 			}
+			subsets.back().push_back(input - argv);
+		}
+		targets.push_back(target);
+	}
+	if(targets.empty()) {
+		std::cerr << "Manifest " << path << " has no outputs\n";
+		return -EINVAL;
+	}
+	std::vector<tcc_source> inputs;
+	for(int i = 0; i < argc; i++)
+		inputs.push_back({argv[i], nullptr, 0});
+	std::vector<tcc_sink> sinks;
+	for(const std::string &output : outputs)
+		sinks.push_back({output.c_str(), nullptr, 0});
+	for(size_t i = 0; i < targets.size(); i++) {
+		targets[i].output = &sinks[i];
+		if(!subsets[i].empty()) {
+			targets[i].inputs = subsets[i].data();
+			targets[i].numinputs = subsets[i].size();
 		}
-		free(indata);
-	} else if(input.colorType == PNG_COLOR_TYPE_RGB) {
-		std::cerr << "Tried to compile pure RGB image. Is it a template?" << std::endl;
-		exit(-1);
 	}
+	return tcc_link_targets(inputs.data(), inputs.size(), targets.data(), targets.size(), &opt);
+}
 
-	//Prepare output
-	palette.insert(palette.begin(), {0, 0, 0});
-	uint8_t zero = 0;
-	mappedpng output;
-	output.x = input.x;
-	output.y = input.y;
-	output.colorType = PNG_COLOR_TYPE_PALETTE;
-	output.bitDepth = 8;
-	output.offset.x = offsetX;
-	output.offset.y = offsetY;
-	output.write = true;
-	output.paletted.alpha = &zero;
-	output.paletted.numtransparent = 1;
-	output.paletted.plt = palette.data();
-	output.paletted.numcolors = palette.size();
-	mapwrite(output_file, &output);
+static int link(const tcc_logger &log, int argc, char **argv) {
+	tcc_link_options opt{};
+	tcc_sink conflictmask{nullptr, nullptr, 0}, histogram{nullptr, nullptr, 0};
+	const char *manifest = nullptr;
+	opt.log = &log;
+	for(; argc >= 2 && argv[0][0] == '-' && argv[0][1] != '\0'; argc -= 2, argv += 2) {
+		std::string_view name(argv[0]);
+		if(name == "-conflicts") {
+			conflictmask.path = argv[1];
+			opt.conflictmask = &conflictmask;
+			continue;
+		}
+		if(name == "-manifest") {
+			manifest = argv[1];
+			continue;
+		}
+		if(name == "-histogram") {
+			histogram.path = argv[1];
+			opt.histogram = &histogram;
+			continue;
+		}
+		char *conv;
+		long value = std::strtol(argv[1], &conv, 10);
+		if(name == "-tile" && conv != argv[1] && value >= 1 && value <= INT32_MAX) {
+			opt.histogramtile = value;
+			continue;
+		}
+		if(conv == argv[1] || value < 0 || value > 1024)
+			goto usage;
+		if(name == "-threads")
+			opt.threads = value;
+		else if(name == "-depth")
+			opt.depth = value;
+		else if(name == "-previews" && value <= 16)
+			opt.numpreviews = value;
+		else
+			goto usage;
+	}
+	if(manifest && (opt.conflictmask || opt.numpreviews || opt.histogram)) {
+		std::cerr << "Conflict mask, previews and histogram need single output, they do not work with -manifest\n";
+		return -EINVAL;
+	}
+	if(manifest && argc >= 1)
+		return linkmanifest(manifest, opt, argc, argv);
+	if(manifest || argc < 2)
+		goto usage;
+	{
+	std::vector<tcc_source> inputs;
+	inputs.reserve(argc - 1);
+	for(int i = 1; i < argc; i++)
+		inputs.push_back({argv[i], nullptr, 0});
+	tcc_sink output{argv[0], nullptr, 0};
+	//Previews are named OUTPUT.2.png, OUTPUT.4.png... with .png of output dropped
+	std::string_view stem(argv[0]);
+	if(stem.ends_with(".png"))
+		stem.remove_suffix(4);
+	std::vector<std::string> names;
+	std::vector<tcc_sink> previews;
+	for(size_t i = 0; i < opt.numpreviews; i++)
+		names.push_back(std::string(stem) + '.' + std::to_string(2 << i) + ".png");
+	for(const std::string &name : names)
+		previews.push_back({name.c_str(), nullptr, 0});
+	opt.previews = previews.data();
+	return tcc_link(inputs.data(), inputs.size(), &opt, &output);
+	}
 
-	//Write
-	png_bytepp rows = (png_bytepp)alloca(output.y * sizeof(png_bytepp));
-	for(png_uint_32 i = 0; i < output.y; i++)
-		rows[i] = data + output.x * i;
-	png_write_image(output.ptr, rows);
+	usage:
+	std::cout << "Link tool usage: [-threads N] [-depth ROWS] [-conflicts MASK] [-previews LEVELS] [-histogram JSON [-tile SIZE]] OUTPUT INPUT1 INPUT2...\n"
+		"\t           [-threads N] [-depth ROWS] -manifest FILE INPUT1 INPUT2...\n"
+		"\tOUTPUT may be - for standard output\n"
+		"\t-manifest   Write several outputs in one pass, every line is OUTPUT [-clip X Y WIDTH HEIGHT] [INPUT...]\n"
+		"\t-conflicts  Write mask of pixels where overlapping inputs disagree\n"
+		"\t-threads    Decode inputs on N worker threads ahead of the writer\n"
+		"\t-depth      Rows decoded ahead per input\n"
+		"\t-previews   Also write OUTPUT.2.png, OUTPUT.4.png... downscaled by majority of 2x2 blocks\n"
+		"\t-histogram  Write palette index counts of output and of every input\n"
+		"\t-tile       Also count output per SIZE x SIZE tile of canvas\n";
+	return -EINVAL;
+}
 
-	//Free memory
-	unmapwrite(output);
-	unmap(&input);
-	free(data);
-	return;
+static int check(const tcc_logger &log, int argc, char **argv) {
+	tcc_check_options opt{};
+	opt.log = &log;
+	for(; argc > 0 && argv[0][0] == '-' && argv[0][1] != '\0';) {
+		std::string_view name(argv[0]);
+		if(name == "-headers") {
+			opt.headersonly = 1;
+			argc--;
+			argv++;
+		} else if(name == "-threads" && argc >= 2) {
+			char *conv;
+			long value = std::strtol(argv[1], &conv, 10);
+			if(conv == argv[1] || value < 0 || value > 1024)
+				goto usage;
+			opt.threads = value;
+			argc -= 2;
+			argv += 2;
+		} else
+			goto usage;
+	}
+	if(argc < 1)
+		goto usage;
+	{
+	std::vector<tcc_source> inputs;
+	inputs.reserve(argc);
+	for(int i = 0; i < argc; i++)
+		inputs.push_back({argv[i], nullptr, 0});
+	return tcc_check(inputs.data(), inputs.size(), &opt);
 	}
 
 	usage:
-	std::cout << "Compile tool usage: OUTPUT INPUT PALETTE OFFSETX OFFSETY" << std::endl;
-	return;
+	std::cout << "Check tool usage: [-threads N] [-headers] INPUT1 INPUT2...\n"
+		"\t-threads    Check on N threads, one per CPU by default\n"
+		"\t-headers    Do not decode pixels\n";
+	return -EINVAL;
+}
 
-	overrange:
-	std::cout << "Offset is too big" << std::endl;
-	return;
+static int catalog(const tcc_logger &log, int argc, char **argv) {
+	tcc_catalog_options opt{};
+	opt.log = &log;
+	if(argc >= 2 && std::string_view(argv[0]) == "-threads") {
+		char *conv;
+		long value = std::strtol(argv[1], &conv, 10);
+		if(conv == argv[1] || value < 0 || value > 1024)
+			goto usage;
+		opt.threads = value;
+		argc -= 2;
+		argv += 2;
+	}
+	if(argc < 2)
+		goto usage;
+	{
+	std::vector<tcc_source> inputs;
+	inputs.reserve(argc - 1);
+	for(int i = 1; i < argc; i++)
+		inputs.push_back({argv[i], nullptr, 0});
+	tcc_sink output{argv[0], nullptr, 0};
+	return tcc_catalog_build(inputs.data(), inputs.size(), &opt, &output);
+	}
+
+	usage:
+	std::cout << "Catalog tool usage: [-threads N] CATALOG INPUT1 INPUT2...\n"
+		"\t-threads    Read headers on N threads, one per CPU by default\n";
+	return -EINVAL;
 }
 
-struct activemapping {
-	mappedpng *png;
-	png_bytep pixels;
-	v2i32 brc;
-//	bool collides;
-	constexpr bool operator <(const activemapping &b) const {
-		return png->offset.x < b.png->offset.x;
+static int query(const tcc_logger &log, int argc, char **argv) {
+	if(argc != 3 && argc != 5)
+		goto usage;
+	{
+	long long values[4] = {0, 0, 1, 1};
+	for(int i = 1; i < argc; i++) {
+		char *conv;
+		values[i - 1] = std::strtoll(argv[i], &conv, 10);
+		if(conv == argv[i])
+			goto usage;
+		if(values[i - 1] > (i < 3 ? INT32_MAX : UINT32_MAX) || values[i - 1] < (i < 3 ? INT32_MIN : 1)) {
+			std::cerr << "Region is out of range\n";
+			return -ERANGE;
+		}
+	}
+	tcc_catalog *cat;
+	tcc_source src{argv[0], nullptr, 0};
+	int err = tcc_catalog_load(&src, &log, &cat);
+	if(err != 0)
+		return err;
+	std::vector<size_t> found(tcc_catalog_query(cat, values[0], values[1], values[2], values[3], nullptr, 0));
+	tcc_catalog_query(cat, values[0], values[1], values[2], values[3], found.data(), found.size());
+	std::sort(found.begin(), found.end());
+	for(size_t i : found) {
+		tcc_catalog_entry e;
+		tcc_catalog_get(cat, i, &e);
+		std::cout << e.name << ' ' << e.x << ' ' << e.y << ' ' << e.width << ' ' << e.height << '\n';
+	}
+	tcc_catalog_free(cat);
+	return 0;
 	}
-};
 
-static constexpr bool operator <(const mappedpng &a, const mappedpng &b) {
-	return a.offset.y < b.offset.y;
+	usage:
+	std::cout << "Query tool usage: CATALOG X Y [WIDTH HEIGHT]\n"
+		"\tPrints path, offset and size of templates covering pixel or rectangle\n";
+	return -EINVAL;
 }
 
-thread_local png_bytep out;
+static int index(const tcc_logger &log, int argc, char **argv) {
+	tcc_index_options opt{};
+	opt.log = &log;
+	if(argc == 4 && std::string_view(argv[0]) == "-span") {
+		char *conv;
+		long value = std::strtol(argv[1], &conv, 10);
+		if(conv == argv[1] || value < 1 || value > INT32_MAX)
+			goto usage;
+		opt.span = value;
+		argc -= 2;
+		argv += 2;
+	}
+	if(argc != 2)
+		goto usage;
+	{
+	tcc_source input{argv[1], nullptr, 0};
+	tcc_sink output{argv[0], nullptr, 0};
+	return tcc_index(&input, &opt, &output);
+	}
 
-static void blendrow(const mappedpng &output, const std::span<const activemapping> ams) {
-	//FIXME: current implementation assumes images will activate in same order they deactivate
-	size_t active = ams.size(), xbase = 0;
-	for(png_int_32 x = output.offset.x, xactive = 0;;) {
-		size_t odist = x - output.offset.x;
-		if(xactive == 0) {
-			//Skip till next or end
-			if(xbase == active) {
-				//End line
-				//Set rest to 0
-				memset(out + odist, 0, output.offset.x + output.x - x);
-				//Write line
-				png_write_row(output.ptr, out);
-				break;
-			}
-		}
-		//Some pngs left
-		if(ams[xbase + xactive].png->offset.x != x) {
-			memset(out + odist, 0, ams[xbase + xactive].png->offset.x - x);
-			x = ams[xbase + xactive].png->offset.x;
-		}
-		for(size_t i = xbase + xactive; i < active; i++)
-			if(ams[i].png->offset.x == x) {
-				xactive++;
-			} else
-				break;
-		if(xactive == 1) {
-			//Write as much as possible
-			if(xbase + xactive == active || ams[xbase].brc.x <= ams[xbase + 1].png->offset.x) {
-				//Write entire image
-				std::copy(ams[xbase].pixels + ams[xbase].png->offset.x - x, ams[xbase].pixels + ams[xbase].png->x, out + odist);
-				x = ams[xbase].brc.x;
-				xactive--;
-				xbase++;
-			} else {
-				//Write partial image
-				std::copy(ams[xbase].pixels + ams[xbase].png->offset.x - x, ams[xbase].pixels + (ams[xbase + 1].png->offset.x - ams[xbase].png->offset.x), out + odist);
-				x = ams[xbase + 1].png->offset.x;
-			}
-		} else {
-			//TODO: not implemented
-			std::cerr << "Overlapping PNGs are not implemented yet" << std::endl;
-			exit(-ENOSYS);
-			//Overwrite with last image for testing
-			std::copy(ams[xbase + xactive - 1].pixels + ams[xbase + xactive - 1].png->offset.x - x, ams[xbase + xactive - 1].pixels + (ams[xbase + xactive - 1].png->x), out + odist);
-			x = ams[xbase + xactive - 1].brc.x;
-			for(size_t i = xbase; i < active; i++)
-				if(ams[i].brc.x <= x) {
-					xbase++;
-					xactive--;
-				} else
-					break;
-			//Write checking for conflicts
+	usage:
+	std::cout << "Index tool usage: [-span ROWS] INDEX PNG\n"
+		"\t-span       Rows between restart points\n";
+	return -EINVAL;
+}
+
+static int crop(const tcc_logger &log, int argc, char **argv) {
+	tcc_crop_options opt{};
+	opt.log = &log;
+	if(argc != 7)
+		goto usage;
+	{
+	long long values[4];
+	for(int i = 0; i < 4; i++) {
+		char *conv;
+		values[i] = std::strtoll(argv[3 + i], &conv, 10);
+		if(conv == argv[3 + i])
+			goto usage;
+		if(values[i] > (i < 2 ? INT32_MAX : UINT32_MAX) || values[i] < (i < 2 ? INT32_MIN : 1)) {
+			std::cerr << "Region is out of range\n";
+			return -ERANGE;
 		}
 	}
+	opt.x = values[0];
+	opt.y = values[1];
+	opt.width = values[2];
+	opt.height = values[3];
+	tcc_source input{argv[1], nullptr, 0}, idx{argv[2], nullptr, 0};
+	tcc_sink output{argv[0], nullptr, 0};
+	return tcc_crop(&input, &idx, &opt, &output);
+	}
+
+	usage:
+	std::cout << "Crop tool usage: OUTPUT PNG INDEX X Y WIDTH HEIGHT\n"
+		"\tRegion is in canvas coordinates, PNG offset is taken into account\n";
+	return -EINVAL;
 }
 
-void link(int argc, char **argv) {
-	if(argc < 3)
+static int render(const tcc_logger &log, int argc, char **argv) {
+	tcc_render_options opt{};
+	opt.log = &log;
+	for(; argc > 0 && argv[0][0] == '-' && argv[0][1] != '\0';) {
+		std::string_view name(argv[0]);
+		if(name == "-canvas" && argc >= 3) {
+			char *conv1, *conv2;
+			long w = std::strtol(argv[1], &conv1, 10), h = std::strtol(argv[2], &conv2, 10);
+			if(conv1 == argv[1] || conv2 == argv[2] || w < 1 || h < 1 || w > INT32_MAX || h > INT32_MAX)
+				goto usage;
+			opt.canvaswidth = w;
+			opt.canvasheight = h;
+			argc -= 3;
+			argv += 3;
+		} else if(name == "-background" && argc >= 2) {
+			char *conv;
+			unsigned long rgba = std::strtoul(argv[1], &conv, 16);
+			if(conv - argv[1] != 8)
+				goto usage;
+			for(int i = 0; i < 4; i++)
+				opt.background[i] = rgba >> (24 - i * 8);
+			argc -= 2;
+			argv += 2;
+		} else
+			goto usage;
+	}
+	if(argc != 2)
 		goto usage;
 	{
-//	std::vector<char*> input_paths(argv + 1, argv + argc - 1);
-	std::vector<mappedpng> inputs;
-	std::vector<activemapping> ams;
-	inputs.reserve(argc - 1);
-	ams.reserve(argc - 1);
-	v2i32 min(INT32_MAX, INT32_MAX), max(INT32_MIN, INT32_MIN);
-	std::vector<color_t> wpalette;
-	for(int i = 0; i < argc - 1; i++) {
-		inputs.push_back(map(argv[i + 1]));
-		mappedpng &png = inputs[i];
-		if(png.colorType != PNG_COLOR_TYPE_PALETTE || png.paletted.numtransparent != 1 || png.paletted.alpha[0] != 0) {
-			std::cerr << "File " << argv[i + 1] << " does not seems to be compiled template" << std::endl;
-		}
-		std::vector<color_t> palette(png.paletted.plt, png.paletted.plt + (size_t)png.paletted.numcolors);
-		if(wpalette.empty()) {
-			wpalette = std::move(palette);
-		} else if(wpalette != palette) {
-			std::cerr << "Palette mismatch, recompile all images" << std::endl;
-			exit(-1);
-		}
-		min = minel(min, png.offset);
-		v2i32 brc = png.offset + v2i32{(png_int_32)png.x, (png_int_32)png.y};
-		max = maxel(max, brc);
+	tcc_source input{argv[1], nullptr, 0};
+	tcc_sink output{argv[0], nullptr, 0};
+	return tcc_render(&input, &opt, &output);
+	}
+
+	usage:
+	std::cout << "Render tool usage: [-canvas WIDTH HEIGHT] [-background RRGGBBAA] OUTPUT INPUT\n"
+		"\t-canvas     Place template at its offset on canvas of this size\n"
+		"\t-background Color under template, transparent by default\n";
+	return -EINVAL;
+}
+
+static int patch(const tcc_logger &log, int argc, char **argv) {
+	if(argc != 3) {
+		std::cout << "Patch tool usage: PATCH OLD NEW\n"
+			"\tOLD and NEW are versions of the same compiled template\n";
+		return -EINVAL;
 	}
-	std::sort(inputs.begin(), inputs.end());
+	tcc_source oldinput{argv[1], nullptr, 0}, newinput{argv[2], nullptr, 0};
+	tcc_sink output{argv[0], nullptr, 0};
+	return tcc_patch(&oldinput, &newinput, &log, &output);
+}
 
-	//Open write mapping
-	mappedpng output;
-	uint8_t zero = 0;
-	output.x = max.x - min.x;
-	output.y = max.y - min.y;
-	output.colorType = PNG_COLOR_TYPE_PALETTE;
-	output.bitDepth = 8;
-	output.offset.x = min.x;
-	output.offset.y = min.y;
-	output.write = true;
-	output.paletted.alpha = &zero;
-	output.paletted.numtransparent = 1;
-	output.paletted.plt = wpalette.data();
-	output.paletted.numcolors = wpalette.size();
-	mapwrite(argv[0], &output);
-	out = (png_bytep)malloc(max.x - min.x);
-	if(out == NULL) {
-		std::cerr << "Out of memory" << std::endl;
-		exit(-ENOMEM);
+static int apply(const tcc_logger &log, int argc, char **argv) {
+	if(argc != 3) {
+		std::cout << "Apply tool usage: NEW OLD PATCH\n";
+		return -EINVAL;
 	}
+	tcc_source oldinput{argv[1], nullptr, 0}, input{argv[2], nullptr, 0};
+	tcc_sink output{argv[0], nullptr, 0};
+	return tcc_apply(&oldinput, &input, &log, &output);
+}
 
-	//FIXME: current implementation assumes images will activate in same order they deactivate
-	for(png_int_32 y = min.y, base = 0, active = 0; y < max.y; y++) {
-		bool dirty = false;
-		//Activate all mappins
-		for(png_int_32 i = base + active; i < argc - 1; i++)
-			if(inputs[i].offset.y == y) {
-				mappedpng &png = inputs[i];
-				v2i32 brc = png.offset + v2i32{(png_int_32)png.x, (png_int_32)png.y};
-				activemapping am{&png, (png_bytep)malloc(png.x), brc};
-				if(am.pixels == NULL) {
-					std::cerr << "Out of memory" << std::endl;
-					exit(-ENOMEM);
-				}
-				ams.push_back(am);
-				active++;
-				dirty = true;
-			} else
-				break;
-		if(dirty)
-			std::sort(ams.begin(), ams.end());
-		//Read rows
-		for(size_t i = 0; i < (size_t)active; i++) {
-			png_read_row(ams[i].png->ptr, ams[i].pixels, NULL);
-		}
-		//Write row
-		blendrow(output, std::span<const activemapping>(ams));
-		//Deactivate useless
-		for(size_t i = 0; i < (size_t)active;) {
-			if(ams[i].brc.y - 1 == y) {
-				free(ams[i].pixels);
-				unmap(ams[i].png);
-				ams.erase(ams.begin() + i);
-				active--;
-			} else
-				i++;
+static int layers(const tcc_logger &log, int argc, char **argv) {
+	tcc_layers_options opt{};
+	opt.log = &log;
+	if(argc < 3)
+		goto usage;
+	{
+	tcc_sink output{argv[0], nullptr, 0}, mask{argv[1], nullptr, 0};
+	//Layer options apply to the image after them
+	std::vector<tcc_source> sources;
+	std::vector<tcc_layer> stack;
+	sources.reserve(argc);
+	tcc_layer layer{nullptr, nullptr, 1};
+	for(int i = 2; i < argc; i++) {
+		std::string_view name(argv[i]);
+		if(name == "-mask" && i + 1 < argc) {
+			sources.push_back({argv[++i], nullptr, 0});
+			layer.mask = &sources.back();
+		} else if(name == "-factor" && i + 1 < argc) {
+			char *conv;
+			float value = std::strtof(argv[++i], &conv);
+			if(conv == argv[i] || *conv != '\0' || !(value >= 0 && value <= 1))
+				goto usage;
+			layer.maskfactor = value;
+		} else if(name[0] == '-' && name.size() > 1)
+			goto usage;
+		else {
+			sources.push_back({argv[i], nullptr, 0});
+			layer.image = &sources.back();
+			stack.push_back(layer);
+			layer = {nullptr, nullptr, 1};
 		}
 	}
-	free(out);
-	unmapwrite(output);
-	return;
+	if(stack.empty() || layer.mask || layer.maskfactor != 1)
+		goto usage;
+	return tcc_layers(stack.data(), stack.size(), &opt, &output, &mask);
 	}
 
 	usage:
-	std::cout << "Link tool usage: OUTPUT INPUT1 INPUT2..." << std::endl;
-	return;
+	std::cout << "Layers tool usage: OUTPUT MASK [-factor F] [-mask LAYERMASK] IMAGE...\n"
+		"\tImages are paletted, RGB or RGBA, later ones are on top, options apply to the next image\n"
+		"\t-mask       Composed into MASK instead of image\n"
+		"\t-factor     Darken layer mask by F from 0 to 1 and make it opaque\n";
+	return -EINVAL;
+}
+
+//Messages of runs writing to standard output
+static void tostderr(void *, tcc_loglevel level, const char *msg) {
+	static const char *const prefixes[] = {"Error: ", "Warning: ", ""};
+	fprintf(stderr, "%s%s\n", prefixes[level], msg);
 }
 
 int main(int argc, char **argv) {
+	tcc_logger log{nullptr, nullptr, TCC_NORMAL};
+	//Global options go before tool name
+	for(; argc >= 2; argc--, argv++) {
+		std::string_view opt(argv[1]);
+		if(opt == "-quiet")
+			log.verbosity = TCC_QUIET;
+		else if(opt == "-verbose")
+			log.verbosity = TCC_VERBOSE;
+		else
+			break;
+	}
 	if(argc < 2) {
-		std::cout << "Usage:\n\t-compile    Create paletted PNG with offset\n\t-link       Create big paletted PNG with offset from smaller ones\n";
+		std::cout << "Usage: [-quiet|-verbose] TOOL ARGS...\n\t-compile    Create paletted PNG with offset\n\t-link       Create big paletted PNG with offset from smaller ones\n"
+			"\t-check      Validate link inputs without writing anything\n\t-catalog    Build header catalog of templates\n\t-query      Find catalog entries intersecting region\n"
+			"\t-render     Expand compiled template to RGBA\n\t-index      Build restart point index for -crop\n\t-crop       Extract region using index\n"
+			"\t-patch      Store difference between two versions of template\n\t-apply      Rebuild new version of template from patch\n"
+			"\t-layers     Compose stack of images and their masks\n";
 		return -1;
 	}
 
+	//"-" is standard input or output, keep messages away from it
+	if(std::find_if(argv + 2, argv + argc, [](const char *arg) { return std::string_view(arg) == "-"; }) != argv + argc)
+		log.fn = tostderr;
+	int err;
 	std::string_view tool(argv[1]);
 	if(tool == "-compile")
-		compile(argc-2, argv+2);
+		err = compile(log, argc-2, argv+2);
 	else if(tool == "-link")
-		link(argc-2, argv+2);
-	else
-		std::cout << "Tool " << tool << " not found" << std::endl;
-	return 0;
+		err = link(log, argc-2, argv+2);
+	else if(tool == "-check")
+		err = check(log, argc-2, argv+2);
+	else if(tool == "-catalog")
+		err = catalog(log, argc-2, argv+2);
+	else if(tool == "-query")
+		err = query(log, argc-2, argv+2);
+	else if(tool == "-render")
+		err = render(log, argc-2, argv+2);
+	else if(tool == "-index")
+		err = index(log, argc-2, argv+2);
+	else if(tool == "-crop")
+		err = crop(log, argc-2, argv+2);
+	else if(tool == "-patch")
+		err = patch(log, argc-2, argv+2);
+	else if(tool == "-apply")
+		err = apply(log, argc-2, argv+2);
+	else if(tool == "-layers")
+		err = layers(log, argc-2, argv+2);
+	else {
+		std::cout << "Tool " << tool << " not found\n";
+		return -1;
+	}
+	if(err != 0 && log.verbosity > TCC_QUIET)
+		std::cerr << "Failed: " << tcc_strerror(err) << '\n';
+	return err;
 }